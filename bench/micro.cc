@@ -0,0 +1,229 @@
+// Microbenchmarks of the work paknob does in-process on every run, apart
+// from talking to the server: parsing its arguments into a subcommand,
+// knob.h's volume math, and what awaiting a reply in a Task costs over
+// chaining callbacks. Prints one JSON object per benchmark, with the time
+// per call as percentiles over batches.
+//
+// Usage: micro [<filter>]
+//
+// With a filter, only benchmarks whose label contains it run.
+//
+// paknob.cc is included whole, with its main renamed out of the way, since
+// what is measured lives in its anonymous namespace.
+
+#define main paknob_main
+#include "paknob.cc"
+#undef main
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+using BenchClock = std::chrono::steady_clock;
+
+// Keeps the compiler from proving a result unused and dropping its work.
+template <typename T>
+void DoNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+const char *filter = nullptr;
+
+// Calls fn(i) in batches sized to take at least kBatchTime each, and prints
+// the time per call of the median batch, the 99th percentile batch and the
+// slowest.
+template <typename Fn>
+void Bench(const char *const label, Fn fn) {
+  constexpr auto kBatchTime = std::chrono::microseconds(200);
+  constexpr int kBatches = 500;
+  if (filter && !strstr(label, filter)) return;
+  uint64_t i = 0;
+  const auto batch = [&](const uint64_t size) {
+    const auto start = BenchClock::now();
+    for (const uint64_t end = i + size; i < end; i++) fn(i);
+    return BenchClock::now() - start;
+  };
+  uint64_t size = 1;
+  while (batch(size) < kBatchTime) size *= 2;
+  std::vector<double> ns;
+  ns.reserve(kBatches);
+  for (int n = 0; n < kBatches; n++) {
+    ns.push_back(std::chrono::duration<double, std::nano>(batch(size)).count() /
+                 size);
+  }
+  std::sort(ns.begin(), ns.end());
+  const double p50 = ns[kBatches / 2];
+  printf(
+      "{\"label\": \"%s\", \"calls\": %llu, \"p50_ns\": %.2f, "
+      "\"p99_ns\": %.2f, \"max_ns\": %.2f, \"per_second\": %.0f}\n",
+      label, static_cast<unsigned long long>(i), p50,
+      ns[kBatches * 99 / 100], ns.back(), 1e9 / p50);
+}
+
+// What main does with its arguments before connecting.
+void BenchParse(const char *const label,
+                const std::vector<absl::string_view> &argv) {
+  Bench(label, [&](uint64_t) {
+    absl::Span<const absl::string_view> args = absl::MakeSpan(argv);
+    Options options;
+    std::unique_ptr<Subcommand> sc;
+    if (ParseOptions(args, &options)) sc = BuildSubcommand(args, options);
+    DoNotOptimize(sc.get());
+  });
+}
+
+pa_cvolume Stereo(const pa_volume_t vol) {
+  pa_cvolume cv;
+  pa_cvolume_set(&cv, 2, vol);
+  return cv;
+}
+
+// Stands in for the mainloop, which calls each reply's callback once it is
+// in: replies are queued, and delivered in order by Dispatch().
+struct Posted {
+  void (*cb)(void *);
+  void *userdata;
+};
+std::vector<Posted> posted;
+void Post(void (*const cb)(void *), void *const userdata) {
+  posted.push_back({cb, userdata});
+}
+void Dispatch() {
+  // Callbacks post more as they go.
+  for (size_t i = 0; i < posted.size(); i++)
+    posted[i].cb(posted[i].userdata);
+  posted.clear();
+}
+
+// A run of ops requests, each sent from the previous one's callback, as
+// increment-* and the knob-* subcommands chain them.
+class CallbackChain : private Caster<CallbackChain> {
+ public:
+  explicit CallbackChain(const int ops) : left_{ops} {}
+  void Run() { Post(ReplyCB, this); }
+
+ private:
+  friend class Caster<CallbackChain>;
+
+  static void ReplyCB(void *const userdata) {
+    const auto chain = Cast(userdata);
+    if (--chain->left_ > 0) Post(ReplyCB, chain);
+  }
+
+  int left_;
+};
+
+// A reply that comes from Dispatch().
+class PostedReply : public Reply<PostedReply> {
+ public:
+  void await_resume() const {}
+
+ private:
+  friend class Reply<PostedReply>;
+
+  bool Send() {
+    Post(ReplyCB, this);
+    return true;
+  }
+  static void ReplyCB(void *const userdata) {
+    static_cast<PostedReply *>(userdata)->Done();
+  }
+};
+
+// The same run as a Task, as set-* and status are written, with its frame
+// from the arena.
+class CoroutineChain {
+ public:
+  explicit CoroutineChain(const int ops) : ops_{ops} {}
+  void Run() { task_ = Main(); }
+  Arena &arena() { return arena_; }
+
+ private:
+  Task Main() {
+    for (int i = 0; i < ops_; i++) co_await PostedReply();
+  }
+
+  const int ops_;
+  Arena arena_;
+  Task task_;
+};
+
+// Builds a chain of ops requests on the heap, as a subcommand is, and
+// dispatches its replies.
+template <typename Chain>
+void BenchChain(const char *const label, const int ops) {
+  Bench(label, [ops](uint64_t) {
+    const auto chain = std::make_unique<Chain>(ops);
+    chain->Run();
+    Dispatch();
+    DoNotOptimize(chain.get());
+  });
+}
+
+}  // namespace
+
+int main(const int argc, char **const argv) {
+  if (argc > 1) filter = argv[1];
+
+  BenchParse("parse get-sink-volume", {"get-sink-volume"});
+  BenchParse("parse set-sink-volume", {"set-sink-volume", "30"});
+  BenchParse("parse increment-sink-volume", {"increment-sink-volume", "5"});
+  BenchParse("parse toggle-source-mute", {"toggle-source-mute"});
+  BenchParse("parse status", {"status"});
+  BenchParse("parse options", {"--fresh", "--timeout=500", "--retry=2000",
+                               "--no-autospawn", "get-sink-volume"});
+  BenchParse("parse multi", {"set-sink-mute", "0", "--", "set-sink-volume",
+                             "40"});
+
+  // Inputs vary with the call so that nothing folds into a constant.
+  Bench("knob Percentage", [](const uint64_t i) {
+    DoNotOptimize(paknob::Percentage(i & 0x1ffff));
+  });
+  Bench("knob FromPercentage", [](const uint64_t i) {
+    DoNotOptimize(paknob::FromPercentage(i % 150));
+  });
+  Bench("knob Average", [](const uint64_t i) {
+    const pa_cvolume cv = Stereo(i & 0x1ffff);
+    DoNotOptimize(paknob::Average(cv));
+  });
+  Bench("knob Plan set", [](const uint64_t i) {
+    pa_cvolume cv = Stereo(PA_VOLUME_NORM);
+    bool mute = false;
+    DoNotOptimize(paknob::Plan(
+        {paknob::Action::kSetVolume, static_cast<int64_t>(i & 0x1ffff)}, &cv,
+        &mute));
+    DoNotOptimize(cv);
+  });
+  Bench("knob Plan adjust", [](const uint64_t i) {
+    pa_cvolume cv = Stereo(i & 0x1ffff);
+    bool mute = false;
+    const int64_t delta = i & 1 ? 3276 : -3276;
+    DoNotOptimize(
+        paknob::Plan({paknob::Action::kAdjustVolume, delta}, &cv, &mute));
+    DoNotOptimize(cv);
+  });
+  Bench("knob Plan toggle", [](const uint64_t i) {
+    pa_cvolume cv = Stereo(PA_VOLUME_NORM);
+    bool mute = i & 1;
+    DoNotOptimize(
+        paknob::Plan({paknob::Action::kToggleMute}, &cv, &mute));
+    DoNotOptimize(mute);
+  });
+  Bench("knob Printed", [](const uint64_t i) {
+    const pa_cvolume cv = Stereo(i & 0x1ffff);
+    DoNotOptimize(paknob::Printed(paknob::Action::kToggleMute, cv, i & 1));
+  });
+
+  // Two requests are what a one-shot subcommand makes; a long chain shows
+  // the cost of each await apart from the frame's.
+  BenchChain<CallbackChain>("chain callback x2", 2);
+  BenchChain<CoroutineChain>("chain coroutine x2", 2);
+  BenchChain<CallbackChain>("chain callback x1000", 1000);
+  BenchChain<CoroutineChain>("chain coroutine x1000", 1000);
+  return EXIT_SUCCESS;
+}
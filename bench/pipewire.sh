@@ -0,0 +1,132 @@
+#!/bin/sh
+# Times paknob's PipeWire path against its pulse path, on a private headless
+# PipeWire with a null sink and a null source, and pipewire-pulse in front of
+# it. Prints one JSON object per command, as spawn does. run.sh runs this
+# for its "pipewire" section.
+#
+# Usage: bench/pipewire.sh <paknob> <spawn>
+#
+# <paknob> must be built with PIPEWIRE=1; its pulse path is taken by giving
+# it a PIPEWIRE_REMOTE that doesn't exist. RUNS is as for run.sh.
+set -eu
+
+if [ $# -ne 2 ]; then
+  echo "usage: $0 <paknob> <spawn>" >&2
+  exit 1
+fi
+paknob=$(realpath "$1")
+spawn=$(realpath "$2")
+runs=${RUNS:-2000}
+
+dir=$(mktemp -d /tmp/paknob_pipewire.XXXXXX)
+export XDG_RUNTIME_DIR="$dir" PIPEWIRE_RUNTIME_DIR="$dir" HOME="$dir"
+export XDG_CONFIG_HOME="$dir/config" PULSE_CLIENTCONFIG="$dir/client.conf"
+unset PIPEWIRE_REMOTE PULSE_SERVER PULSE_RUNTIME_PATH PULSE_COOKIE DISPLAY
+printf 'autospawn = no\n' > "$PULSE_CLIENTCONFIG"
+
+# Just the modules for the devices and the default metadata, which a session
+# manager would otherwise keep.
+cat > "$dir/pipewire.conf" << 'EOF'
+context.properties = {
+  support.dbus = false
+}
+context.spa-libs = {
+  audio.convert.* = audioconvert/libspa-audioconvert
+  support.*       = support/libspa-support
+}
+context.modules = [
+  { name = libpipewire-module-protocol-native }
+  { name = libpipewire-module-metadata }
+  { name = libpipewire-module-adapter }
+]
+context.objects = [
+  { factory = adapter
+    args = {
+      factory.name = support.null-audio-sink
+      node.name = bench_sink
+      media.class = Audio/Sink
+      audio.position = [ FL FR ]
+      monitor.channel-volumes = true
+      object.linger = true
+    }
+  }
+  { factory = adapter
+    args = {
+      factory.name = support.null-audio-sink
+      node.name = bench_source
+      media.class = Audio/Source/Virtual
+      audio.position = [ FL FR ]
+      object.linger = true
+    }
+  }
+  { factory = metadata
+    args = {
+      metadata.name = default
+      metadata.values = [
+        { key = default.audio.sink
+          type = Spa:String:JSON
+          value = { "name": "bench_sink" } }
+        { key = default.audio.source
+          type = Spa:String:JSON
+          value = { "name": "bench_source" } }
+      ]
+    }
+  }
+]
+EOF
+
+pipewire -c "$dir/pipewire.conf" 2> "$dir/pipewire.log" &
+pipewire=$!
+pulse=
+cleanup() {
+  kill $pipewire $pulse
+  wait || true
+  rm -rf "$dir"
+}
+trap cleanup EXIT
+tries=0
+until [ -S "$dir/pipewire-0" ]; do
+  tries=$((tries + 1))
+  if [ $tries -ge 100 ]; then
+    echo "pipewire didn't start; see its log:" >&2
+    cat "$dir/pipewire.log" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+pipewire-pulse 2> "$dir/pipewire-pulse.log" &
+pulse=$!
+tries=0
+until pactl info > /dev/null 2>&1; do
+  tries=$((tries + 1))
+  if [ $tries -ge 100 ]; then
+    echo "pipewire-pulse didn't start; see its log:" >&2
+    cat "$dir/pipewire-pulse.log" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+bench() {
+  label=$1
+  shift
+  echo "$label" >&2
+  "$spawn" --runs="$runs" --label="$label" -- "$@" < /dev/null ||
+    echo "$label: some runs failed" >&2
+}
+
+for sub in get-sink-volume 'set-sink-volume 30' 'increment-sink-volume 1' \
+  'decrement-sink-volume 1' get-source-volume 'set-source-volume 30' \
+  'increment-source-volume 1' 'decrement-source-volume 1' get-sink-mute \
+  'set-sink-mute 0' toggle-sink-mute get-source-mute 'set-source-mute 0' \
+  toggle-source-mute; do
+  pactl set-sink-volume bench_sink 50%
+  pactl set-source-volume bench_source 50%
+  # shellcheck disable=SC2086
+  bench "paknob $sub, pipewire" "$paknob" --fresh $sub
+  pactl set-sink-volume bench_sink 50%
+  pactl set-source-volume bench_source 50%
+  # shellcheck disable=SC2086
+  bench "paknob $sub, pipewire-pulse" \
+    env PIPEWIRE_REMOTE=paknob-bench-none "$paknob" --fresh $sub
+done
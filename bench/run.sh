@@ -0,0 +1,233 @@
+#!/bin/sh
+# Benchmarks paknob against pactl on a private PulseAudio with a null sink
+# and a null source, and prints the results as one JSON document on stdout,
+# in sections:
+#
+#   spawn     how long whole runs of each one-shot subcommand take
+#   client    paknob-client's runs against paknob's
+#   native    paknob-client's native backend against paknob's libpulse
+#   pipewire  paknob's PipeWire path against its pulse path, on PipeWire
+#   syscalls  the system calls of one run of each one-shot subcommand
+#   micro     the in-process microbenchmarks
+#
+# Usage: bench/run.sh <paknob> <paknob-client> <native-client> <spawn> <micro>
+#
+# <native-client> is paknob-client built with NATIVE=1.
+#
+# RUNS sets how many times each command runs, 2000 by default. Needs
+# pulseaudio and pactl. "syscalls" also needs strace, and "pipewire" needs
+# pipewire, pipewire-pulse and a paknob built with PIPEWIRE=1; each is left
+# empty without them. Nothing touches the session's own server.
+set -eu
+
+if [ $# -ne 5 ]; then
+  echo "usage: $0 <paknob> <paknob-client> <native-client> <spawn> <micro>" >&2
+  exit 1
+fi
+paknob=$(realpath "$1")
+client=$(realpath "$2")
+native=$(realpath "$3")
+spawn=$(realpath "$4")
+micro=$(realpath "$5")
+runs=${RUNS:-2000}
+
+dir=$(mktemp -d /tmp/paknob_bench.XXXXXX)
+export XDG_RUNTIME_DIR="$dir" HOME="$dir"
+export PULSE_CLIENTCONFIG="$dir/client.conf"
+unset PULSE_SERVER PULSE_RUNTIME_PATH PULSE_COOKIE DISPLAY
+printf 'autospawn = no\n' > "$PULSE_CLIENTCONFIG"
+mkdir -m 700 "$dir/pulse"
+# paknob-client execs paknob from PATH when it can't do a request itself.
+PATH="$(dirname "$paknob"):$PATH"
+
+pulseaudio -n --daemonize=no --exit-idle-time=-1 --use-pid-file=no \
+  --log-target=file:"$dir/pulseaudio.log" \
+  --load="module-native-protocol-unix socket=$dir/pulse/native" \
+  --load="module-null-sink sink_name=bench_sink" \
+  --load="module-null-source source_name=bench_source" &
+server=$!
+daemon=
+cleanup() {
+  kill $server $daemon
+  wait || true
+  rm -rf "$dir"
+}
+trap cleanup EXIT
+tries=0
+until pactl info > /dev/null 2>&1; do
+  tries=$((tries + 1))
+  if [ $tries -ge 100 ]; then
+    echo "pulseaudio didn't start; see its log:" >&2
+    cat "$dir/pulseaudio.log" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+pactl set-default-sink bench_sink
+pactl set-default-source bench_source
+
+# Appends spawn's result for the command after the label to the section
+# named first.
+bench() {
+  section=$1
+  label=$2
+  shift 2
+  echo "$label" >&2
+  "$spawn" --runs="$runs" --label="$label" -- "$@" \
+    < /dev/null >> "$dir/$section.jsonl" ||
+    echo "$label: some runs failed" >&2
+}
+
+# Appends the system calls made by one run of the command after the label,
+# as strace -c counts them, to the "syscalls" section.
+syscalls() {
+  label=$1
+  shift
+  echo "$label" >&2
+  strace -f -c -o "$dir/strace" "$@" < /dev/null > /dev/null ||
+    echo "$label: failed" >&2
+  awk -v label="$label" '
+    /^-/ { dashes++; next }
+    dashes == 1 {
+      names[++n] = $NF
+      calls[$NF] = $4
+    }
+    dashes == 2 {
+      total = $4
+      errors = NF == 6 ? $5 : 0
+    }
+    END {
+      printf("{\"label\": \"%s\", \"syscalls\": %d, \"errors\": %d, " \
+             "\"calls\": {", label, total, errors)
+      for (i = 1; i <= n; i++)
+        printf("%s\"%s\": %d", i > 1 ? ", " : "", names[i], calls[names[i]])
+      print "}}"
+    }' "$dir/strace" >> "$dir/syscalls.jsonl"
+}
+
+# Each one-shot subcommand, and what pactl does the same with, if anything.
+oneshots() {
+  cat << EOF
+get-sink-volume|get-sink-volume @DEFAULT_SINK@
+set-sink-volume 30|set-sink-volume @DEFAULT_SINK@ 30%
+increment-sink-volume 1|set-sink-volume @DEFAULT_SINK@ +1%
+decrement-sink-volume 1|set-sink-volume @DEFAULT_SINK@ -1%
+get-source-volume|get-source-volume @DEFAULT_SOURCE@
+set-source-volume 30|set-source-volume @DEFAULT_SOURCE@ 30%
+increment-source-volume 1|set-source-volume @DEFAULT_SOURCE@ +1%
+decrement-source-volume 1|set-source-volume @DEFAULT_SOURCE@ -1%
+get-sink-mute|get-sink-mute @DEFAULT_SINK@
+set-sink-mute 0|set-sink-mute @DEFAULT_SINK@ 0
+toggle-sink-mute|set-sink-mute @DEFAULT_SINK@ toggle
+get-source-mute|get-source-mute @DEFAULT_SOURCE@
+set-source-mute 0|set-source-mute @DEFAULT_SOURCE@ 0
+toggle-source-mute|set-source-mute @DEFAULT_SOURCE@ toggle
+status|
+EOF
+}
+
+# Volumes are reset before each, so that increments don't climb for ever.
+reset_all() {
+  pactl set-sink-volume bench_sink 50%
+  pactl set-source-volume bench_source 50%
+}
+oneshots | while IFS='|' read -r sub equivalent; do
+  reset_all
+  # shellcheck disable=SC2086
+  bench spawn "paknob $sub" "$paknob" --fresh $sub
+  reset_all
+  # shellcheck disable=SC2086
+  bench spawn "paknob --control-only $sub" "$paknob" --fresh --control-only \
+    $sub
+  if [ -n "$equivalent" ]; then
+    reset_all
+    # shellcheck disable=SC2086
+    bench spawn "pactl $sub" pactl $equivalent
+  fi
+done
+
+# What each costs in system calls, with and without shared memory set up.
+touch "$dir/syscalls.jsonl"
+if command -v strace > /dev/null; then
+  oneshots | while IFS='|' read -r sub equivalent; do
+    # shellcheck disable=SC2086
+    syscalls "paknob $sub" "$paknob" --fresh $sub
+    # shellcheck disable=SC2086
+    syscalls "paknob --control-only $sub" "$paknob" --fresh --control-only \
+      $sub
+  done
+else
+  echo "strace isn't installed; skipping syscalls" >&2
+fi
+
+# paknob-client against paknob, first with no daemon, when the client execs
+# paknob or, built with NATIVE=1, does the request itself, and then with one,
+# when both only forward and paknob's cost is in loading its libraries.
+reset() {
+  pactl set-sink-volume bench_sink 50%
+  pactl set-sink-mute bench_sink 0
+}
+clients() {
+  printf '%s\n' get-sink-volume 'increment-sink-volume 1' toggle-sink-mute
+}
+clients | while read -r sub; do
+  reset
+  # shellcheck disable=SC2086
+  bench client "paknob-client $sub" "$client" $sub
+done
+"$paknob" daemon &
+daemon=$!
+tries=0
+until [ -S "$dir/paknob.sock" ]; do
+  tries=$((tries + 1))
+  if [ $tries -ge 100 ]; then
+    echo "paknob daemon didn't start" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+clients | while read -r sub; do
+  reset
+  # shellcheck disable=SC2086
+  bench client "paknob $sub, daemon" "$paknob" $sub
+  reset
+  # shellcheck disable=SC2086
+  bench client "paknob-client $sub, daemon" "$client" $sub
+done
+kill $daemon
+wait $daemon || true
+daemon=
+
+# With no daemon, the native backend does every one-shot volume and mute
+# request itself, over the same socket and cookie libpulse would use. The
+# runs' peak RSS shows what not loading libpulse saves in memory.
+oneshots | while IFS='|' read -r sub equivalent; do
+  [ "$sub" != status ] || continue
+  reset_all
+  # shellcheck disable=SC2086
+  bench native "paknob $sub, libpulse" "$paknob" --fresh $sub
+  reset_all
+  # shellcheck disable=SC2086
+  bench native "paknob-client $sub, native" "$native" $sub
+done
+
+touch "$dir/pipewire.jsonl"
+if ldd "$paknob" | grep -q libpipewire && command -v pipewire > /dev/null &&
+  command -v pipewire-pulse > /dev/null; then
+  "$(dirname "$0")/pipewire.sh" "$paknob" "$spawn" > "$dir/pipewire.jsonl" ||
+    echo "pipewire: failed" >&2
+else
+  echo "no PipeWire, or paknob built without it; skipping pipewire" >&2
+fi
+
+echo micro >&2
+"$micro" > "$dir/micro.jsonl"
+
+# The sections, each a JSON array of what was appended to it.
+printf '{\n  "runs": %d' "$runs"
+for section in spawn client native pipewire syscalls micro; do
+  printf ',\n  "%s": [\n' "$section"
+  sed -e 's/^/    /' -e '$!s/$/,/' "$dir/$section.jsonl"
+  printf '  ]'
+done
+printf '\n}\n'
@@ -0,0 +1,129 @@
+// Runs a command many times over, one after the other, and prints one JSON
+// object with how long each run took from fork to reaping, as percentiles,
+// how many runs that makes a second, and the largest peak RSS of any run.
+//
+// Usage: spawn [--runs=<n>] [--warmup=<n>] [--label=<label>] -- <command>...
+//
+// The command's stdout goes to /dev/null. Runs that exit with a status other
+// than 0 are counted as failures, and still timed.
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Run {
+  int64_t ns;
+  long max_rss_kb;
+  bool ok;
+};
+
+Run Spawn(char **const argv, const int null) {
+  const auto start = Clock::now();
+  const pid_t pid = fork();
+  if (pid < 0) return {0, 0, false};
+  if (pid == 0) {
+    dup2(null, STDOUT_FILENO);
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  int status;
+  rusage usage;
+  if (wait4(pid, &status, 0, &usage) != pid) return {0, 0, false};
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start)
+                      .count();
+  return {ns, usage.ru_maxrss,
+          WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS};
+}
+
+// The nearest-rank percentile of sorted.
+int64_t Percentile(const std::vector<int64_t> &sorted, const int p) {
+  const size_t rank = (sorted.size() * p + 99) / 100;
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+// Quotes s for JSON, which for labels and arguments means escaping quotes
+// and backslashes.
+std::string Quote(const char *s) {
+  std::string quoted = "\"";
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') quoted += '\\';
+    quoted += *s;
+  }
+  return quoted + "\"";
+}
+
+}  // namespace
+
+int main(const int argc, char **const argv) {
+  int runs = 1000;
+  int warmup = 10;
+  const char *label = nullptr;
+  int i = 1;
+  for (; i < argc && strcmp(argv[i], "--") != 0; i++) {
+    if (strncmp(argv[i], "--runs=", 7) == 0) {
+      runs = atoi(argv[i] + 7);
+    } else if (strncmp(argv[i], "--warmup=", 9) == 0) {
+      warmup = atoi(argv[i] + 9);
+    } else if (strncmp(argv[i], "--label=", 8) == 0) {
+      label = argv[i] + 8;
+    } else {
+      break;
+    }
+  }
+  if (i + 1 >= argc || strcmp(argv[i], "--") != 0 || runs <= 0) {
+    fprintf(stderr,
+            "%s [--runs=<n>] [--warmup=<n>] [--label=<label>] -- "
+            "<command>...\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  char **const command = argv + i + 1;
+  const int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (null < 0) return EXIT_FAILURE;
+  for (int n = 0; n < warmup; n++) Spawn(command, null);
+
+  std::vector<int64_t> ns;
+  ns.reserve(runs);
+  long max_rss_kb = 0;
+  int failures = 0;
+  const auto start = Clock::now();
+  for (int n = 0; n < runs; n++) {
+    const Run run = Spawn(command, null);
+    ns.push_back(run.ns);
+    max_rss_kb = std::max(max_rss_kb, run.max_rss_kb);
+    if (!run.ok) failures++;
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  std::sort(ns.begin(), ns.end());
+
+  std::string args = "[";
+  for (char **arg = command; *arg; arg++) {
+    if (arg != command) args += ", ";
+    args += Quote(*arg);
+  }
+  args += "]";
+  printf(
+      "{\"label\": %s, \"command\": %s, \"runs\": %d, \"failures\": %d, "
+      "\"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, "
+      "\"per_second\": %.1f, \"max_rss_kb\": %ld}\n",
+      Quote(label ? label : command[0]).c_str(), args.c_str(), runs, failures,
+      Percentile(ns, 50) / 1e3, Percentile(ns, 99) / 1e3, ns.back() / 1e3,
+      runs / seconds, max_rss_kb);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
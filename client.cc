@@ -0,0 +1,229 @@
+// paknob-client forwards requests to `paknob daemon` without loading libpulse
+// or Abseil, and execs paknob to do the work itself when no daemon is
+// listening or the request is not one it knows how to forward. Built with
+// PAKNOB_NATIVE, it first tries a lone request that only involves volume and
+// mute state over the server's native protocol itself.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "protocol.h"
+#ifdef PAKNOB_NATIVE
+#include "native.h"
+#endif
+
+#ifndef PAKNOB_BINARY
+#define PAKNOB_BINARY "paknob"
+#endif
+
+namespace {
+// How long to wait for the daemon's reply, past which the request may have
+// been made and can't be handed to paknob; the client exits with
+// kExitTimeout.
+constexpr int kDefaultForwardTimeoutMs = 2000;
+
+enum class Arg { kNone, kPercentage, kSignedPercentage, kBool, kOptional };
+struct Verb {
+  std::string_view name;
+  Arg arg;
+};
+// Must stay a subset of what Subcommand::Build in paknob.cc accepts. Anything
+// not matched here is handed to paknob, which has the final word.
+constexpr Verb kVerbs[] = {
+    {"get-sink-volume", Arg::kNone},
+    {"set-sink-volume", Arg::kPercentage},
+    {"increment-sink-volume", Arg::kSignedPercentage},
+    {"decrement-sink-volume", Arg::kSignedPercentage},
+    {"get-source-volume", Arg::kNone},
+    {"set-source-volume", Arg::kPercentage},
+    {"increment-source-volume", Arg::kSignedPercentage},
+    {"decrement-source-volume", Arg::kSignedPercentage},
+    {"get-sink-mute", Arg::kNone},
+    {"set-sink-mute", Arg::kBool},
+    {"toggle-sink-mute", Arg::kNone},
+    {"get-source-mute", Arg::kNone},
+    {"set-source-mute", Arg::kBool},
+    {"toggle-source-mute", Arg::kNone},
+    {"status", Arg::kOptional},
+};
+
+// Small enough that paknob's percentage arithmetic cannot overflow.
+bool IsPercentage(const std::string_view arg) {
+  if (arg.empty() || arg.size() > 5) return false;
+  unsigned long val = 0;
+  for (const char c : arg) {
+    if (c < '0' || c > '9') return false;
+    val = val * 10 + (c - '0');
+  }
+  return val <= 0xffff;
+}
+
+bool IsValid(const Arg arg, const int argc, char **const argv) {
+  if (arg == Arg::kNone) return argc == 0;
+  if (arg == Arg::kOptional) return argc <= 1;
+  if (argc != 1) return false;
+  std::string_view val = argv[0];
+  switch (arg) {
+    case Arg::kSignedPercentage:
+      if (!val.empty() && val.front() == '-') val.remove_prefix(1);
+      [[fallthrough]];
+    case Arg::kPercentage:
+      return IsPercentage(val);
+    case Arg::kBool:
+      return val == "0" || val == "1";
+    case Arg::kNone:
+    case Arg::kOptional:
+    default:
+      return false;
+  }
+}
+
+bool IsSubcommand(const int argc, char **const argv) {
+  if (argc < 1) return false;
+  for (const auto &verb : kVerbs) {
+    if (verb.name == argv[0]) return IsValid(verb.arg, argc - 1, argv + 1);
+  }
+  return false;
+}
+
+// Several subcommands may be separated by "--".
+bool IsForwardable(int argc, char **argv) {
+  while (true) {
+    int len = 0;
+    while (len < argc && std::string_view(argv[len]) != "--") len++;
+    if (!IsSubcommand(len, argv)) return false;
+    if (len == argc) return true;
+    argc -= len + 1;
+    argv += len + 1;
+  }
+}
+
+#ifdef PAKNOB_NATIVE
+struct NativeVerb {
+  std::string_view name;
+  paknob::Action action;
+  bool sink;
+  // Whether a delta goes the other way.
+  bool dec;
+};
+constexpr NativeVerb kNativeVerbs[] = {
+    {"get-sink-volume", paknob::Action::kGetVolume, true, false},
+    {"set-sink-volume", paknob::Action::kSetVolume, true, false},
+    {"increment-sink-volume", paknob::Action::kAdjustVolume, true, false},
+    {"decrement-sink-volume", paknob::Action::kAdjustVolume, true, true},
+    {"get-source-volume", paknob::Action::kGetVolume, false, false},
+    {"set-source-volume", paknob::Action::kSetVolume, false, false},
+    {"increment-source-volume", paknob::Action::kAdjustVolume, false, false},
+    {"decrement-source-volume", paknob::Action::kAdjustVolume, false, true},
+    {"get-sink-mute", paknob::Action::kGetMute, true, false},
+    {"set-sink-mute", paknob::Action::kSetMute, true, false},
+    {"toggle-sink-mute", paknob::Action::kToggleMute, true, false},
+    {"get-source-mute", paknob::Action::kGetMute, false, false},
+    {"set-source-mute", paknob::Action::kSetMute, false, false},
+    {"toggle-source-mute", paknob::Action::kToggleMute, false, false},
+};
+
+// How long a read or write of the server's may take before the request is
+// given up on.
+constexpr int kNativeTimeoutMs = 2000;
+
+// Takes digits IsValid has checked.
+uint32_t ParseVolume(const std::string_view arg) {
+  uint32_t percentage = 0;
+  for (const char c : arg) percentage = percentage * 10 + (c - '0');
+  return paknob::FromPercentage(percentage);
+}
+
+// Does what paknob would, through knob.h, so that either prints the same.
+template <typename Traits>
+int RunNative(const NativeVerb &verb, const char *const arg) {
+  paknob::native::Connection conn;
+  if (!conn.Connect(kNativeTimeoutMs)) return -1;
+  paknob::native::Info info;
+  // Nothing has changed yet, so paknob may as well try.
+  if (!conn.GetInfo<Traits>(&info)) return conn.timed_out() ? -1 : EXIT_FAILURE;
+  paknob::Request req{verb.action};
+  switch (verb.action) {
+    case paknob::Action::kSetVolume:
+      req.arg = ParseVolume(arg);
+      break;
+    case paknob::Action::kAdjustVolume: {
+      std::string_view val = arg;
+      bool neg = !val.empty() && val.front() == '-';
+      if (neg) val.remove_prefix(1);
+      neg = neg != verb.dec;
+      req.arg = neg ? -int64_t{ParseVolume(val)} : int64_t{ParseVolume(val)};
+      break;
+    }
+    case paknob::Action::kSetMute:
+      req.arg = arg[0] == '1';
+      break;
+    default:
+      break;
+  }
+  switch (paknob::Plan(req, &info.volume, &info.mute)) {
+    case paknob::Write::kNone:
+      break;
+    case paknob::Write::kVolume:
+      if (!conn.SetVolume<Traits>(info.volume))
+        return conn.timed_out() ? paknob::kExitTimeout : EXIT_FAILURE;
+      break;
+    case paknob::Write::kMute:
+      if (!conn.SetMute<Traits>(info.mute))
+        return conn.timed_out() ? paknob::kExitTimeout : EXIT_FAILURE;
+      break;
+  }
+  if (verb.action == paknob::Action::kGetMute) {
+    printf("%d\n", info.mute ? 1 : 0);
+  } else {
+    printf("%d\n", paknob::Percentage(paknob::Printed(
+                        verb.action, info.volume, info.mute)));
+  }
+  return EXIT_SUCCESS;
+}
+
+// Does a lone request over the native protocol. Returns the exit status, or
+// -1 if paknob should do it after all, which it may only be asked to before
+// anything has changed.
+int RunNative(const int argc, char **const argv) {
+  if (!IsSubcommand(argc, argv)) return -1;
+  for (const auto &verb : kNativeVerbs) {
+    if (verb.name != argv[0]) continue;
+    const char *const arg = argc > 1 ? argv[1] : "";
+    // Out of range, which paknob will report.
+    if ((verb.action == paknob::Action::kSetVolume ||
+         verb.action == paknob::Action::kAdjustVolume) &&
+        ParseVolume(arg[0] == '-' ? arg + 1 : arg) > paknob::kVolumeMax)
+      return -1;
+    return verb.sink ? RunNative<paknob::native::SinkTraits>(verb, arg)
+                     : RunNative<paknob::native::SourceTraits>(verb, arg);
+  }
+  return -1;
+}
+#endif
+}  // namespace
+
+int main(const int argc, char **const argv) {
+  if (argc >= 1 && IsForwardable(argc - 1, argv + 1)) {
+    std::string req;
+    for (int i = 1; i < argc; i++) paknob::AppendArg(&req, argv[i]);
+    if (const int ret = paknob::Forward(req, kDefaultForwardTimeoutMs);
+        ret >= 0)
+      return ret;
+#ifdef PAKNOB_NATIVE
+    if (const int ret = RunNative(argc - 1, argv + 1); ret >= 0) return ret;
+#endif
+  }
+  char paknob[] = PAKNOB_BINARY;
+  if (argc >= 1) argv[0] = paknob;
+  execvp(paknob, argv);
+  perror(paknob);
+  return EXIT_FAILURE;
+}
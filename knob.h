@@ -0,0 +1,104 @@
+#ifndef PAKNOB_KNOB_H_
+#define PAKNOB_KNOB_H_
+
+// What paknob's volume and mute requests do to a device, shared by paknob,
+// libpaknob and paknob-client's native path, so that all three agree on what
+// a percentage is, how far an adjustment goes and what each request writes.
+// Like protocol.h, this must not depend on libpulse or Abseil: volumes are
+// pa_volume_t values, and a CVolume is a pa_cvolume or anything else with
+// channels and values.
+
+#include <algorithm>
+#include <cstdint>
+
+namespace paknob {
+
+// PA_VOLUME_NORM, PA_VOLUME_MUTED and PA_VOLUME_MAX.
+inline constexpr uint32_t kVolumeNorm = 0x10000;
+inline constexpr uint32_t kVolumeMuted = 0;
+inline constexpr uint32_t kVolumeMax = UINT32_MAX / 2;
+
+// Both conversions are in pa_volume_t arithmetic, wraparound included, so
+// that whichever of the three did a request prints the same.
+inline int Percentage(const uint32_t vol) {
+  return (vol * 100 + kVolumeNorm / 2) / kVolumeNorm;
+}
+inline uint32_t FromPercentage(const uint32_t percentage) {
+  return percentage * kVolumeNorm / 100;
+}
+
+// pa_cvolume_avg.
+template <typename CVolume>
+uint32_t Average(const CVolume &cv) {
+  if (cv.channels == 0) return kVolumeMuted;
+  uint64_t sum = 0;
+  for (int i = 0; i < cv.channels; i++) sum += cv.values[i];
+  return sum / cv.channels;
+}
+
+// Moves every channel by the same amount, stopping at silence and at the
+// maximum rather than wrapping.
+template <typename CVolume>
+void Adjust(CVolume *const cv, const bool neg, const uint32_t vol_adj) {
+  for (int i = 0; i < cv->channels; i++) {
+    if (neg)
+      cv->values[i] -= std::min<uint32_t>(cv->values[i], vol_adj);
+    else
+      cv->values[i] = std::min<uint32_t>(cv->values[i] + vol_adj, kVolumeMax);
+  }
+}
+
+enum class Action {
+  kGetVolume,
+  kSetVolume,
+  kAdjustVolume,
+  kGetMute,
+  kSetMute,
+  kToggleMute,
+};
+// A request of a default device. arg is the volume to set, the signed
+// amount to adjust by, or the mute state to set.
+struct Request {
+  Action action;
+  int64_t arg = 0;
+};
+enum class Write { kNone, kVolume, kMute };
+
+// Takes the device's state as read and leaves what the request will make
+// it, returning which of the two must be written.
+template <typename CVolume>
+Write Plan(const Request &req, CVolume *const cv, bool *const mute) {
+  switch (req.action) {
+    case Action::kGetVolume:
+    case Action::kGetMute:
+      return Write::kNone;
+    case Action::kSetVolume:
+      std::fill_n(cv->values, cv->channels, static_cast<uint32_t>(req.arg));
+      return Write::kVolume;
+    case Action::kAdjustVolume:
+      Adjust(cv, req.arg < 0,
+             std::min<uint64_t>(req.arg < 0 ? -req.arg : req.arg,
+                                kVolumeMax));
+      return Write::kVolume;
+    case Action::kSetMute:
+      *mute = req.arg;
+      return Write::kMute;
+    case Action::kToggleMute:
+      *mute = !*mute;
+      return Write::kMute;
+  }
+  return Write::kNone;
+}
+
+// The volume paknob prints once a request is done: what the device was
+// left at, or silence for a request that muted it.
+template <typename CVolume>
+uint32_t Printed(const Action action, const CVolume &cv, const bool mute) {
+  if ((action == Action::kSetMute || action == Action::kToggleMute) && mute)
+    return kVolumeMuted;
+  return Average(cv);
+}
+
+}  // namespace paknob
+
+#endif  // PAKNOB_KNOB_H_
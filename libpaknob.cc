@@ -0,0 +1,454 @@
+// libpaknob: the C library described in libpaknob.h. It shares what each
+// request does with paknob through knob.h, but none of paknob's one-shot
+// machinery, which a long-lived connection has no use for.
+
+#include "libpaknob.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+
+#include "knob.h"
+#include "pulse/context.h"
+#include "pulse/def.h"
+#include "pulse/introspect.h"
+#include "pulse/mainloop-api.h"
+#include "pulse/operation.h"
+#include "pulse/subscribe.h"
+#include "pulse/thread-mainloop.h"
+#include "pulse/timeval.h"
+#include "pulse/volume.h"
+
+static_assert(paknob::kVolumeNorm == PA_VOLUME_NORM);
+static_assert(paknob::kVolumeMax == PA_VOLUME_MAX);
+
+namespace {
+
+struct Request {
+  paknob_handle *p;
+  paknob_target target;
+  paknob::Request req;
+  paknob_result_cb cb;
+  void *userdata;
+  pa_cvolume cv;
+  bool mute;
+};
+
+// Follows one default device for the change callback. Events that arrive
+// while a fetch is outstanding cause just one more.
+struct Watch {
+  paknob_handle *p;
+  paknob_target target;
+  bool fetching = false;
+  bool stale = false;
+  bool known = false;
+  int volume = 0;
+  int mute = 0;
+};
+
+}  // namespace
+
+struct paknob_handle {
+  pa_threaded_mainloop *m = nullptr;
+  pa_context *ctx = nullptr;
+  std::string name;
+  // Whether ctx has ever been ready, after which losing it means connecting
+  // again rather than failing paknob_new.
+  bool connected = false;
+  pa_time_event *reconnect = nullptr;
+  std::list<std::unique_ptr<Request>> requests;
+  paknob_change_cb change_cb = nullptr;
+  void *change_userdata = nullptr;
+  Watch watches[2];
+};
+
+namespace {
+
+constexpr const char *kDefaultNames[] = {"@DEFAULT_SINK@",
+                                         "@DEFAULT_SOURCE@"};
+constexpr pa_usec_t kReconnectDelay = PA_USEC_PER_SEC;
+
+// Holds the handle's lock, unless on the handle's thread, which has it.
+class Lock {
+ public:
+  explicit Lock(pa_threaded_mainloop *const m)
+      : m_{pa_threaded_mainloop_in_thread(m) ? nullptr : m} {
+    if (m_) pa_threaded_mainloop_lock(m_);
+  }
+  ~Lock() {
+    if (m_) pa_threaded_mainloop_unlock(m_);
+  }
+
+ private:
+  pa_threaded_mainloop *const m_;
+};
+
+void Complete(Request *const r, const int status) {
+  paknob_handle *const p = r->p;
+  const int volume = paknob::Percentage(pa_cvolume_avg(&r->cv));
+  const paknob_result_cb cb = r->cb;
+  void *const userdata = r->userdata;
+  const bool mute = r->mute;
+  p->requests.remove_if([r](const auto &req) { return req.get() == r; });
+  cb(p, status, status == 0 ? volume : 0, status == 0 && mute, userdata);
+}
+
+bool Issue(pa_operation *const op) {
+  if (!op) return false;
+  pa_operation_unref(op);
+  return true;
+}
+
+void SuccessCB(pa_context *, const int success, void *const userdata) {
+  Request *const r = static_cast<Request *>(userdata);
+  Complete(r, success ? 0 : -1);
+}
+
+template <typename InfoT>
+void InfoCB(pa_context *const ctx, const InfoT *const info, const int eol,
+            void *const userdata) {
+  Request *const r = static_cast<Request *>(userdata);
+  if (eol < 0) return Complete(r, -1);
+  if (eol) return;
+  r->cv = info->volume;
+  r->mute = info->mute;
+  const char *const name = kDefaultNames[r->target];
+  const bool sink = r->target == PAKNOB_TARGET_SINK;
+  bool ok = true;
+  switch (paknob::Plan(r->req, &r->cv, &r->mute)) {
+    case paknob::Write::kNone:
+      return Complete(r, 0);
+    case paknob::Write::kVolume:
+      ok = Issue(sink ? pa_context_set_sink_volume_by_name(ctx, name, &r->cv,
+                                                           SuccessCB, r)
+                      : pa_context_set_source_volume_by_name(
+                            ctx, name, &r->cv, SuccessCB, r));
+      break;
+    case paknob::Write::kMute:
+      ok = Issue(sink ? pa_context_set_sink_mute_by_name(ctx, name, r->mute,
+                                                         SuccessCB, r)
+                      : pa_context_set_source_mute_by_name(
+                            ctx, name, r->mute, SuccessCB, r));
+      break;
+  }
+  if (!ok) Complete(r, -1);
+}
+
+// The request paknob would make of percentages: arg is the percentage,
+// delta or mute state asked for, or -1 to toggle.
+bool ToRequest(const paknob::Action action, const int arg,
+               paknob::Request *const req) {
+  const uint64_t vol =
+      uint64_t{static_cast<unsigned>(arg < 0 ? -int64_t{arg} : arg)} *
+      PA_VOLUME_NORM / 100;
+  switch (action) {
+    case paknob::Action::kSetVolume:
+      if (arg < 0 || !PA_VOLUME_IS_VALID(vol)) return false;
+      *req = {action, static_cast<int64_t>(vol)};
+      return true;
+    case paknob::Action::kAdjustVolume:
+      *req = {action, arg < 0 ? -static_cast<int64_t>(vol)
+                              : static_cast<int64_t>(vol)};
+      return true;
+    case paknob::Action::kSetMute:
+      if (arg < -1 || arg > 1) return false;
+      *req = arg < 0 ? paknob::Request{paknob::Action::kToggleMute}
+                     : paknob::Request{action, arg};
+      return true;
+    default:
+      *req = {action};
+      return true;
+  }
+}
+
+int Start(paknob_handle *const p, const paknob_target target,
+          const paknob::Action action, const int arg,
+          const paknob_result_cb cb, void *const userdata) {
+  if (!p || !cb ||
+      (target != PAKNOB_TARGET_SINK && target != PAKNOB_TARGET_SOURCE))
+    return -1;
+  paknob::Request req;
+  if (!ToRequest(action, arg, &req)) return -1;
+  Lock lock(p->m);
+  if (pa_context_get_state(p->ctx) != PA_CONTEXT_READY) return -1;
+  p->requests.push_back(std::make_unique<Request>(
+      Request{p, target, req, cb, userdata, {}, false}));
+  Request *const r = p->requests.back().get();
+  const char *const name = kDefaultNames[target];
+  if (Issue(target == PAKNOB_TARGET_SINK
+                ? pa_context_get_sink_info_by_name(
+                      p->ctx, name, InfoCB<pa_sink_info>, r)
+                : pa_context_get_source_info_by_name(
+                      p->ctx, name, InfoCB<pa_source_info>, r)))
+    return 0;
+  p->requests.pop_back();
+  return -1;
+}
+
+struct Result {
+  bool done = false;
+  int status = -1;
+  int volume = 0;
+  int mute = 0;
+};
+
+void BlockingCB(paknob_handle *const p, const int status, const int volume,
+                const int mute, void *const userdata) {
+  Result *const result = static_cast<Result *>(userdata);
+  *result = {true, status, volume, mute};
+  pa_threaded_mainloop_signal(p->m, 0);
+}
+
+int Wait(paknob_handle *const p, const paknob_target target,
+         const paknob::Action action, const int arg, int *const volume,
+         int *const mute) {
+  if (!p || pa_threaded_mainloop_in_thread(p->m)) return -1;
+  Result result;
+  pa_threaded_mainloop_lock(p->m);
+  if (Start(p, target, action, arg, BlockingCB, &result) == 0) {
+    while (!result.done) pa_threaded_mainloop_wait(p->m);
+  }
+  pa_threaded_mainloop_unlock(p->m);
+  if (result.status != 0) return -1;
+  if (volume) *volume = result.volume;
+  if (mute) *mute = result.mute;
+  return 0;
+}
+
+void Fetch(Watch *watch);
+
+template <typename InfoT>
+void WatchCB(pa_context *, const InfoT *const info, const int eol,
+             void *const userdata) {
+  Watch *const watch = static_cast<Watch *>(userdata);
+  paknob_handle *const p = watch->p;
+  if (!eol) {
+    const int volume = paknob::Percentage(pa_cvolume_avg(&info->volume));
+    const int mute = info->mute ? 1 : 0;
+    if (watch->known && volume == watch->volume && mute == watch->mute)
+      return;
+    watch->known = true;
+    watch->volume = volume;
+    watch->mute = mute;
+    if (p->change_cb)
+      p->change_cb(p, watch->target, volume, mute, p->change_userdata);
+    return;
+  }
+  watch->fetching = false;
+  if (watch->stale) Fetch(watch);
+}
+
+void Fetch(Watch *const watch) {
+  paknob_handle *const p = watch->p;
+  if (!p->change_cb) return;
+  if (watch->fetching) {
+    watch->stale = true;
+    return;
+  }
+  const char *const name = kDefaultNames[watch->target];
+  watch->stale = false;
+  watch->fetching = Issue(
+      watch->target == PAKNOB_TARGET_SINK
+          ? pa_context_get_sink_info_by_name(p->ctx, name,
+                                             WatchCB<pa_sink_info>, watch)
+          : pa_context_get_source_info_by_name(
+                p->ctx, name, WatchCB<pa_source_info>, watch));
+}
+
+// Any sink event may be a change of the default sink's volume, and a server
+// event may be a change of default.
+void EventCB(pa_context *, const pa_subscription_event_type_t type, uint32_t,
+             void *const userdata) {
+  paknob_handle *const p = static_cast<paknob_handle *>(userdata);
+  switch (type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+    case PA_SUBSCRIPTION_EVENT_SINK:
+      return Fetch(&p->watches[PAKNOB_TARGET_SINK]);
+    case PA_SUBSCRIPTION_EVENT_SOURCE:
+      return Fetch(&p->watches[PAKNOB_TARGET_SOURCE]);
+    case PA_SUBSCRIPTION_EVENT_SERVER:
+      Fetch(&p->watches[PAKNOB_TARGET_SINK]);
+      return Fetch(&p->watches[PAKNOB_TARGET_SOURCE]);
+    default:
+      return;
+  }
+}
+
+void StateCB(pa_context *ctx, void *userdata);
+
+// Starts p->ctx connecting. Called with the lock held.
+bool Connect(paknob_handle *const p) {
+  pa_context_set_state_callback(p->ctx, StateCB, p);
+  pa_context_set_subscribe_callback(p->ctx, EventCB, p);
+  return pa_context_connect(p->ctx, /* server = */ nullptr,
+                            PA_CONTEXT_NOFLAGS, /* api = */ nullptr) == 0;
+}
+
+void Reconnect(paknob_handle *p);
+
+// A context that has failed can't connect again, so this replaces it.
+void ReconnectCB(pa_mainloop_api *const api, pa_time_event *const e,
+                 const timeval *, void *const userdata) {
+  paknob_handle *const p = static_cast<paknob_handle *>(userdata);
+  api->time_free(e);
+  p->reconnect = nullptr;
+  pa_context *const ctx = pa_context_new(api, p->name.c_str());
+  if (!ctx) return Reconnect(p);
+  pa_context_set_state_callback(p->ctx, nullptr, nullptr);
+  pa_context_set_subscribe_callback(p->ctx, nullptr, nullptr);
+  pa_context_unref(p->ctx);
+  p->ctx = ctx;
+  if (!Connect(p)) Reconnect(p);
+}
+
+// Tries connecting again after kReconnectDelay, unless that is already
+// scheduled.
+void Reconnect(paknob_handle *const p) {
+  if (p->reconnect) return;
+  pa_mainloop_api *const api = pa_threaded_mainloop_get_api(p->m);
+  timeval tv;
+  pa_timeval_add(pa_gettimeofday(&tv), kReconnectDelay);
+  p->reconnect = api->time_new(api, &tv, ReconnectCB, p);
+}
+
+// Wakes paknob_new, and fails whatever is outstanding once the connection
+// is lost, since its callbacks will never come. A connection that had been
+// ready is replaced, and the watches catch up with whatever changed while it
+// was down.
+void StateCB(pa_context *const ctx, void *const userdata) {
+  paknob_handle *const p = static_cast<paknob_handle *>(userdata);
+  switch (pa_context_get_state(ctx)) {
+    case PA_CONTEXT_READY:
+      p->connected = true;
+      Issue(pa_context_subscribe(
+          ctx,
+          static_cast<pa_subscription_mask_t>(PA_SUBSCRIPTION_MASK_SINK |
+                                              PA_SUBSCRIPTION_MASK_SOURCE |
+                                              PA_SUBSCRIPTION_MASK_SERVER),
+          nullptr, nullptr));
+      for (Watch &watch : p->watches) Fetch(&watch);
+      break;
+    case PA_CONTEXT_FAILED:
+    case PA_CONTEXT_TERMINATED:
+      while (!p->requests.empty()) Complete(p->requests.front().get(), -1);
+      for (Watch &watch : p->watches) watch.fetching = false;
+      if (p->connected && pa_context_get_state(ctx) == PA_CONTEXT_FAILED)
+        Reconnect(p);
+      break;
+    default:
+      return;
+  }
+  pa_threaded_mainloop_signal(p->m, 0);
+}
+
+}  // namespace
+
+extern "C" {
+
+paknob_handle *paknob_new(const char *const name) {
+  auto p = std::make_unique<paknob_handle>();
+  for (const paknob_target target :
+       {PAKNOB_TARGET_SINK, PAKNOB_TARGET_SOURCE})
+    p->watches[target] = Watch{p.get(), target};
+  p->name = name ? name : "paknob";
+  p->m = pa_threaded_mainloop_new();
+  if (!p->m) return nullptr;
+  p->ctx = pa_context_new(pa_threaded_mainloop_get_api(p->m), p->name.c_str());
+  if (!p->ctx) {
+    pa_threaded_mainloop_free(p->m);
+    return nullptr;
+  }
+  pa_threaded_mainloop_lock(p->m);
+  bool ok = Connect(p.get()) && pa_threaded_mainloop_start(p->m) == 0;
+  if (ok) {
+    pa_context_state_t state;
+    while ((state = pa_context_get_state(p->ctx)) != PA_CONTEXT_READY &&
+           PA_CONTEXT_IS_GOOD(state))
+      pa_threaded_mainloop_wait(p->m);
+    ok = state == PA_CONTEXT_READY;
+  }
+  pa_threaded_mainloop_unlock(p->m);
+  if (!ok) {
+    paknob_free(p.release());
+    return nullptr;
+  }
+  return p.release();
+}
+
+void paknob_free(paknob_handle *const p) {
+  if (!p) return;
+  pa_threaded_mainloop_stop(p->m);
+  pa_context_set_state_callback(p->ctx, nullptr, nullptr);
+  pa_context_disconnect(p->ctx);
+  // The thread is stopped, so outstanding requests fail here instead, before
+  // the handle their callbacks are given goes.
+  while (!p->requests.empty()) Complete(p->requests.front().get(), -1);
+  pa_context_unref(p->ctx);
+  pa_threaded_mainloop_free(p->m);
+  delete p;
+}
+
+int paknob_get(paknob_handle *const p, const paknob_target target,
+               int *const volume, int *const mute) {
+  return Wait(p, target, paknob::Action::kGetVolume, 0, volume, mute);
+}
+
+int paknob_set_volume(paknob_handle *const p, const paknob_target target,
+                      const int volume, int *const volume_out,
+                      int *const mute_out) {
+  return Wait(p, target, paknob::Action::kSetVolume, volume, volume_out,
+              mute_out);
+}
+
+int paknob_adjust_volume(paknob_handle *const p, const paknob_target target,
+                         const int delta, int *const volume_out,
+                         int *const mute_out) {
+  return Wait(p, target, paknob::Action::kAdjustVolume, delta, volume_out,
+              mute_out);
+}
+
+int paknob_set_mute(paknob_handle *const p, const paknob_target target,
+                    const int mute, int *const volume_out,
+                    int *const mute_out) {
+  return Wait(p, target, paknob::Action::kSetMute, mute, volume_out, mute_out);
+}
+
+int paknob_get_async(paknob_handle *const p, const paknob_target target,
+                     const paknob_result_cb cb, void *const userdata) {
+  return Start(p, target, paknob::Action::kGetVolume, 0, cb, userdata);
+}
+
+int paknob_set_volume_async(paknob_handle *const p, const paknob_target target,
+                            const int volume, const paknob_result_cb cb,
+                            void *const userdata) {
+  return Start(p, target, paknob::Action::kSetVolume, volume, cb, userdata);
+}
+
+int paknob_adjust_volume_async(paknob_handle *const p,
+                               const paknob_target target, const int delta,
+                               const paknob_result_cb cb,
+                               void *const userdata) {
+  return Start(p, target, paknob::Action::kAdjustVolume, delta, cb, userdata);
+}
+
+int paknob_set_mute_async(paknob_handle *const p, const paknob_target target,
+                          const int mute, const paknob_result_cb cb,
+                          void *const userdata) {
+  return Start(p, target, paknob::Action::kSetMute, mute, cb, userdata);
+}
+
+void paknob_set_change_callback(paknob_handle *const p,
+                                const paknob_change_cb cb,
+                                void *const userdata) {
+  if (!p) return;
+  Lock lock(p->m);
+  p->change_cb = cb;
+  p->change_userdata = userdata;
+  for (Watch &watch : p->watches) {
+    watch.known = false;
+    Fetch(&watch);
+  }
+}
+
+}  // extern "C"
@@ -0,0 +1,74 @@
+#ifndef PAKNOB_LIBPAKNOB_H_
+#define PAKNOB_LIBPAKNOB_H_
+
+// libpaknob does what paknob's volume and mute subcommands do, for programs
+// that would otherwise run paknob: a handle keeps one connection to the
+// server, served by a thread of its own, for as long as it lives.
+//
+// Volumes are percentages, as paknob prints them. Calls return 0 on success
+// and -1 on failure. Callbacks run on the handle's thread, where the blocking
+// calls must not be made and paknob_free must not be called.
+//
+// If the server goes away, or restarts, outstanding requests fail and the
+// handle connects again a second later, and every second after that until
+// it succeeds. Until then, calls fail. The change callback, once connected
+// again, reports whatever changed meanwhile.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct paknob_handle paknob_handle;
+
+enum paknob_target {
+  PAKNOB_TARGET_SINK,
+  PAKNOB_TARGET_SOURCE,
+};
+
+// Connects, waiting until the connection is ready. Returns NULL on failure.
+// name is what the server lists the client as, or NULL for "paknob".
+paknob_handle *paknob_new(const char *name);
+// Requests still outstanding fail, calling back with status -1 from the
+// calling thread before it returns.
+void paknob_free(paknob_handle *p);
+
+// Blocking calls. Any of the results may be NULL. Like paknob, they act on
+// the default device, and report its volume and mute state afterwards.
+int paknob_get(paknob_handle *p, enum paknob_target target, int *volume,
+               int *mute);
+int paknob_set_volume(paknob_handle *p, enum paknob_target target,
+                      int volume, int *volume_out, int *mute_out);
+// By delta percentage points, clamped as paknob clamps.
+int paknob_adjust_volume(paknob_handle *p, enum paknob_target target,
+                         int delta, int *volume_out, int *mute_out);
+// mute is 0 or 1, or -1 to toggle.
+int paknob_set_mute(paknob_handle *p, enum paknob_target target, int mute,
+                    int *volume_out, int *mute_out);
+
+// The same, calling back with the outcome instead of waiting for it. Return
+// -1, without calling back, if the request couldn't be sent.
+typedef void (*paknob_result_cb)(paknob_handle *p, int status, int volume,
+                                 int mute, void *userdata);
+int paknob_get_async(paknob_handle *p, enum paknob_target target,
+                     paknob_result_cb cb, void *userdata);
+int paknob_set_volume_async(paknob_handle *p, enum paknob_target target,
+                            int volume, paknob_result_cb cb, void *userdata);
+int paknob_adjust_volume_async(paknob_handle *p, enum paknob_target target,
+                               int delta, paknob_result_cb cb,
+                               void *userdata);
+int paknob_set_mute_async(paknob_handle *p, enum paknob_target target,
+                          int mute, paknob_result_cb cb, void *userdata);
+
+// Calls back with a default device's volume and mute state whenever either
+// changes, including when the default changes, and once for each device to
+// begin with. NULL stops it.
+typedef void (*paknob_change_cb)(paknob_handle *p, enum paknob_target target,
+                                 int volume, int mute, void *userdata);
+void paknob_set_change_callback(paknob_handle *p, paknob_change_cb cb,
+                                void *userdata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PAKNOB_LIBPAKNOB_H_
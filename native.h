@@ -0,0 +1,376 @@
+#ifndef PAKNOB_NATIVE_H_
+#define PAKNOB_NATIVE_H_
+
+// Just enough of the PulseAudio native protocol for paknob-client to read and
+// change a default device's volume and mute state without libpulse: cookie
+// authentication, the client name, and getting information and setting
+// volume and mute by name. There is no shared memory, no memblocks and no
+// streams, and one command is outstanding at a time. Like protocol.h, this
+// must not depend on libpulse or Abseil.
+//
+// Every packet is a 20 byte descriptor, whose first word is the length of
+// what follows and whose second is ~0 for commands, followed by a tagstruct:
+// values each preceded by a tag byte saying what they are, in network byte
+// order. Commands and replies start with the command and a tag that the
+// reply echoes.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "knob.h"
+#include "protocol.h"
+
+namespace paknob {
+namespace native {
+
+inline constexpr uint32_t kChannelsMax = 32;
+
+// The counterparts of SinkTraits and SourceTraits in paknob.cc.
+struct SinkTraits {
+  static inline constexpr uint32_t kGetInfo = 21;
+  static inline constexpr uint32_t kSetVolume = 36;
+  static inline constexpr uint32_t kSetMute = 39;
+  static inline constexpr char kDefaultName[] = "@DEFAULT_SINK@";
+};
+struct SourceTraits {
+  static inline constexpr uint32_t kGetInfo = 23;
+  static inline constexpr uint32_t kSetVolume = 38;
+  static inline constexpr uint32_t kSetMute = 40;
+  static inline constexpr char kDefaultName[] = "@DEFAULT_SOURCE@";
+};
+
+// A pa_cvolume, for knob.h.
+struct CVolume {
+  uint8_t channels = 0;
+  uint32_t values[kChannelsMax] = {};
+};
+// What paknob needs of a pa_sink_info or pa_source_info.
+struct Info {
+  CVolume volume;
+  bool mute = false;
+};
+
+class Tagstruct {
+ public:
+  void U32(const uint32_t val) {
+    data_.push_back('L');
+    Raw32(val);
+  }
+  void Bool(const bool val) { data_.push_back(val ? '1' : '0'); }
+  void String(const std::string_view val) {
+    data_.push_back('t');
+    data_.append(val.data(), val.size());
+    data_.push_back('\0');
+  }
+  void Arbitrary(const void *const val, const uint32_t size) {
+    data_.push_back('x');
+    Raw32(size);
+    data_.append(reinterpret_cast<const char *>(val), size);
+  }
+  void Volume(const CVolume &cv) {
+    data_.push_back('v');
+    data_.push_back(static_cast<char>(cv.channels));
+    for (int i = 0; i < cv.channels; i++) Raw32(cv.values[i]);
+  }
+  // Properties with string values, as a pa_proplist.
+  void Proplist(const std::string_view key, const std::string_view val) {
+    data_.push_back('P');
+    String(key);
+    U32(val.size() + 1);
+    Arbitrary(std::string(val).c_str(), val.size() + 1);
+    data_.push_back('N');
+  }
+  [[nodiscard]] const std::string &data() const { return data_; }
+
+ private:
+  void Raw32(const uint32_t val) {
+    const uint32_t be = htonl(val);
+    data_.append(reinterpret_cast<const char *>(&be), sizeof(be));
+  }
+
+  std::string data_;
+};
+
+// Reads a tagstruct, failing once anything is not what was expected.
+class Reader {
+ public:
+  explicit Reader(const std::string_view data) : data_{data} {}
+  bool U32(uint32_t *const val) { return Tag('L') && Raw32(val); }
+  bool U8(uint8_t *const val) {
+    if (data_.empty()) return false;
+    *val = static_cast<uint8_t>(data_.front());
+    data_.remove_prefix(1);
+    return true;
+  }
+  bool Bool(bool *const val) {
+    if (Tag('1')) {
+      *val = true;
+    } else if (Tag('0')) {
+      *val = false;
+    } else {
+      return false;
+    }
+    return true;
+  }
+  // A null string reads as empty.
+  bool String(std::string_view *const val) {
+    *val = {};
+    if (Tag('N')) return true;
+    if (!Tag('t')) return false;
+    const size_t end = data_.find('\0');
+    if (end == data_.npos) return false;
+    *val = data_.substr(0, end);
+    data_.remove_prefix(end + 1);
+    return true;
+  }
+  bool SkipString() {
+    std::string_view val;
+    return String(&val);
+  }
+  bool SkipSampleSpec() { return Tag('a') && Skip(6); }
+  bool SkipChannelMap() {
+    uint8_t channels;
+    return Tag('m') && U8(&channels) && Skip(channels);
+  }
+  bool Volume(CVolume *const cv) {
+    if (!Tag('v') || !U8(&cv->channels) || cv->channels > kChannelsMax)
+      return false;
+    for (int i = 0; i < cv->channels; i++)
+      if (!Raw32(&cv->values[i])) return false;
+    return true;
+  }
+
+ private:
+  bool Tag(const char tag) {
+    if (data_.empty() || data_.front() != tag) return false;
+    data_.remove_prefix(1);
+    return true;
+  }
+  bool Raw32(uint32_t *const val) {
+    if (data_.size() < sizeof(*val)) return false;
+    memcpy(val, data_.data(), sizeof(*val));
+    *val = ntohl(*val);
+    data_.remove_prefix(sizeof(*val));
+    return true;
+  }
+  bool Skip(const size_t n) {
+    if (data_.size() < n) return false;
+    data_.remove_prefix(n);
+    return true;
+  }
+
+  std::string_view data_;
+};
+
+class Connection {
+ public:
+  Connection() = default;
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
+  ~Connection() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+  // Connects and authenticates, failing any read or write that takes longer
+  // than timeout_ms, then and after. Returns false if the server is not one
+  // this can reach, so that libpulse should be left to find it.
+  bool Connect(const int timeout_ms) {
+    if (getenv("PULSE_SERVER") || getenv("PULSE_RUNTIME_PATH")) return false;
+    sockaddr_un addr;
+    if (!RuntimeAddress("pulse/native", &addr)) return false;
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) return false;
+    const timeval tv = {timeout_ms / 1000, timeout_ms % 1000 * 1000};
+    if (setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0 ||
+        setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0)
+      return false;
+    if (connect(fd_, reinterpret_cast<const sockaddr *>(&addr),
+                sizeof(addr)) != 0)
+      return false;
+    Tagstruct auth = Command(kAuth);
+    auth.U32(kVersion);
+    char cookie[kCookieLength] = {};
+    ReadCookie(cookie);
+    auth.Arbitrary(cookie, sizeof(cookie));
+    Reader reply("");
+    uint32_t version;
+    if (!Send(auth, /* creds = */ true) || !Receive(&reply) ||
+        !reply.U32(&version) || (version & 0xffff) < 13)
+      return false;
+    Tagstruct name = Command(kSetClientName);
+    name.Proplist("application.name", "paknob");
+    return Send(name) && Receive(&reply);
+  }
+
+  template <typename Traits>
+  bool GetInfo(Info *const info) {
+    Tagstruct get = Command(Traits::kGetInfo);
+    get.U32(kInvalidIndex);
+    get.String(Traits::kDefaultName);
+    // Only the index, name, description, sample spec, channel map and owner
+    // module come before the volume and mute state.
+    Reader reply("");
+    uint32_t index, module;
+    return Send(get) && Receive(&reply) && reply.U32(&index) &&
+           reply.SkipString() && reply.SkipString() &&
+           reply.SkipSampleSpec() && reply.SkipChannelMap() &&
+           reply.U32(&module) && reply.Volume(&info->volume) &&
+           reply.Bool(&info->mute);
+  }
+  template <typename Traits>
+  bool SetVolume(const CVolume &cv) {
+    Tagstruct set = Command(Traits::kSetVolume);
+    set.U32(kInvalidIndex);
+    set.String(Traits::kDefaultName);
+    set.Volume(cv);
+    Reader reply("");
+    return Send(set) && Receive(&reply);
+  }
+  template <typename Traits>
+  bool SetMute(const bool mute) {
+    Tagstruct set = Command(Traits::kSetMute);
+    set.U32(kInvalidIndex);
+    set.String(Traits::kDefaultName);
+    set.Bool(mute);
+    Reader reply("");
+    return Send(set) && Receive(&reply);
+  }
+
+  // Whether the last call failed for a read or write taking too long.
+  [[nodiscard]] bool timed_out() const { return timed_out_; }
+
+ private:
+  static inline constexpr uint32_t kError = 0;
+  static inline constexpr uint32_t kReply = 2;
+  static inline constexpr uint32_t kAuth = 8;
+  static inline constexpr uint32_t kSetClientName = 9;
+  // Without the flags offering shared memory and memfds.
+  static inline constexpr uint32_t kVersion = 32;
+  static inline constexpr uint32_t kCommandChannel = ~0u;
+  static inline constexpr uint32_t kInvalidIndex = ~0u;
+  static inline constexpr size_t kCookieLength = 256;
+  static inline constexpr size_t kDescriptorWords = 5;
+
+  // As libpulse looks for it. Without one, a server that checks credentials
+  // may still let us in.
+  static void ReadCookie(char *const cookie) {
+    std::string path;
+    if (const char *const env = getenv("PULSE_COOKIE"); env && *env) {
+      path = env;
+    } else if (const char *const config = getenv("XDG_CONFIG_HOME");
+               config && *config) {
+      path = std::string(config) + "/pulse/cookie";
+    } else if (const char *const home = getenv("HOME"); home && *home) {
+      path = std::string(home) + "/.config/pulse/cookie";
+    } else {
+      return;
+    }
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    size_t n = 0;
+    while (n < kCookieLength) {
+      const ssize_t r = read(fd, cookie + n, kCookieLength - n);
+      if (r < 0 && errno == EINTR) continue;
+      if (r <= 0) break;
+      n += r;
+    }
+    close(fd);
+    if (n != kCookieLength) memset(cookie, 0, kCookieLength);
+  }
+
+  Tagstruct Command(const uint32_t command) {
+    Tagstruct t;
+    t.U32(command);
+    t.U32(++tag_);
+    return t;
+  }
+  // Sends a command, with our credentials attached if asked, as libpulse
+  // does for authentication.
+  bool Send(const Tagstruct &t, const bool creds = false) {
+    const std::string &payload = t.data();
+    const uint32_t descriptor[kDescriptorWords] = {
+        htonl(payload.size()), htonl(kCommandChannel), 0, 0, 0};
+    std::string packet(reinterpret_cast<const char *>(descriptor),
+                       sizeof(descriptor));
+    packet += payload;
+    if (!creds) return WriteAll(fd_, packet) || Fail();
+    iovec iov = {packet.data(), packet.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(ucred))] = {};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *const cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_CREDENTIALS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(ucred));
+    const ucred cred = {getpid(), getuid(), getgid()};
+    memcpy(CMSG_DATA(cmsg), &cred, sizeof(cred));
+    ssize_t n;
+    while ((n = sendmsg(fd_, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    if (n < 0) return Fail();
+    if (n == 0) return false;
+    return WriteAll(fd_, std::string_view(packet).substr(n)) || Fail();
+  }
+  bool ReadExactly(char *const buf, const size_t size) {
+    size_t n = 0;
+    while (n < size) {
+      const ssize_t r = read(fd_, buf + n, size - n);
+      if (r < 0 && errno == EINTR) continue;
+      if (r < 0) return Fail();
+      if (r == 0) return false;
+      n += r;
+    }
+    return true;
+  }
+  // Notes whether the read or write that just failed timed out.
+  bool Fail() {
+    timed_out_ = errno == EAGAIN || errno == EWOULDBLOCK;
+    return false;
+  }
+  // Waits for the reply to the last command, passing over anything else the
+  // server sends meanwhile. Fails on an error reply.
+  bool Receive(Reader *const reply) {
+    while (true) {
+      uint32_t descriptor[kDescriptorWords];
+      if (!ReadExactly(reinterpret_cast<char *>(descriptor),
+                       sizeof(descriptor)))
+        return false;
+      const uint32_t size = ntohl(descriptor[0]);
+      // Far beyond any reply to what this sends.
+      if (size > 1 << 20) return false;
+      packet_.resize(size);
+      if (!ReadExactly(packet_.data(), size)) return false;
+      if (ntohl(descriptor[1]) != kCommandChannel) continue;
+      *reply = Reader(packet_);
+      uint32_t command, tag;
+      if (!reply->U32(&command) || !reply->U32(&tag)) return false;
+      if (tag != tag_ || (command != kReply && command != kError)) continue;
+      return command == kReply;
+    }
+  }
+
+  int fd_ = -1;
+  uint32_t tag_ = 0;
+  bool timed_out_ = false;
+  std::string packet_;
+};
+
+}  // namespace native
+}  // namespace paknob
+
+#endif  // PAKNOB_NATIVE_H_
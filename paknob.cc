@@ -1,19 +1,55 @@
+#include <fcntl.h>
+#include <glob.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <coroutine>
 #include <csignal>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <optional>
+#include <random>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "absl/functional/any_invocable.h"
+#include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_replace.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
 #include "absl/types/span.h"
+#include "knob.h"
+#include "protocol.h"
+#include "state.h"
+#ifdef PAKNOB_PIPEWIRE
+#include "pipewire.h"
+#endif
 #include "pulse/context.h"
 #include "pulse/def.h"
 #include "pulse/introspect.h"
@@ -21,8 +57,15 @@
 #include "pulse/mainloop-signal.h"
 #include "pulse/mainloop.h"
 #include "pulse/operation.h"
+#include "pulse/rtclock.h"
+#include "pulse/subscribe.h"
+#include "pulse/timeval.h"
 #include "pulse/volume.h"
 
+static_assert(paknob::kVolumeNorm == PA_VOLUME_NORM);
+static_assert(paknob::kVolumeMuted == PA_VOLUME_MUTED);
+static_assert(paknob::kVolumeMax == PA_VOLUME_MAX);
+
 namespace {
 using UniqueMainloop =
     std::unique_ptr<pa_mainloop, absl::AnyInvocable<void(pa_mainloop *)>>;
@@ -41,14 +84,1076 @@ UniqueContext NewUniqueContext(pa_mainloop_api *const api,
     if (ctx) pa_context_unref(ctx);
   });
 }
+
+// Gives up on the server once any operation has been outstanding for longer
+// than a timeout, for --timeout. Watching is a no-op unless it has been
+// started.
+class Watchdog {
+ public:
+  static void Start(pa_mainloop_api *const api, const pa_usec_t timeout) {
+    watchdog_.reset(new Watchdog(api, timeout));
+  }
+  static void Watch(pa_operation *const op) {
+    if (!watchdog_ || !op) return;
+    watchdog_->ops_.push_back(
+        {pa_operation_ref(op), Now() + watchdog_->timeout_});
+    watchdog_->Arm();
+  }
+
+ private:
+  struct Deadline {
+    pa_operation *op;
+    pa_usec_t at;
+  };
+
+  explicit Watchdog(pa_mainloop_api *const api, const pa_usec_t timeout)
+      : api_{api}, timeout_{timeout}, timer_{nullptr} {}
+  static pa_usec_t Now() {
+    timeval tv;
+    return pa_timeval_load(pa_gettimeofday(&tv));
+  }
+  // Deadlines are in order, so only the earliest needs a timer.
+  void Arm() {
+    if (timer_ || ops_.empty()) return;
+    timeval tv;
+    pa_timeval_store(&tv, ops_.front().at);
+    timer_ = api_->time_new(api_, &tv, TimerCB, this);
+  }
+  static void TimerCB(pa_mainloop_api *const api, pa_time_event *const timer,
+                      const timeval *, void *const userdata) {
+    const auto w = reinterpret_cast<Watchdog *>(userdata);
+    api->time_free(timer);
+    w->timer_ = nullptr;
+    auto &ops = w->ops_;
+    ops.erase(std::remove_if(ops.begin(), ops.end(),
+                             [](const Deadline &d) {
+                               if (pa_operation_get_state(d.op) ==
+                                   PA_OPERATION_RUNNING)
+                                 return false;
+                               pa_operation_unref(d.op);
+                               return true;
+                             }),
+              ops.end());
+    if (!ops.empty() && ops.front().at <= Now())
+      return api->quit(api, paknob::kExitTimeout);
+    w->Arm();
+  }
+
+  static inline std::unique_ptr<Watchdog> watchdog_;
+  pa_mainloop_api *const api_;
+  const pa_usec_t timeout_;
+  pa_time_event *timer_;
+  std::vector<Deadline> ops_;
+};
+
+// Counts requests, replies, output and mainloop wakeups, cheaply enough to be
+// always on. For --stats, they are reported at exit in Prometheus' text
+// format.
+class Stats {
+ public:
+  enum Op {
+    kGetInfo,
+    kSetVolume,
+    kSetMute,
+    kGetServerInfo,
+    kSubscribe,
+    kNumOps,
+  };
+
+  static int64_t Now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t{ts.tv_sec} * 1000000000 + ts.tv_nsec;
+  }
+  static void Request(const Op op) { Add(&requests_[op]); }
+  // Counts a request that the daemon's cache answered without the server.
+  static void CacheHit(const Op op) { Add(&cache_hits_[op]); }
+  // Records how long a request took from sending it to its complete reply.
+  static void Reply(const Op op, const int64_t ns) {
+    Histogram &h = latency_[op];
+    const auto bucket = std::lower_bound(std::begin(kBucketsNs),
+                                         std::end(kBucketsNs), ns) -
+                        std::begin(kBucketsNs);
+    Add(&h.buckets[bucket]);
+    Add(&h.sum_ns, ns);
+  }
+  static void Event() { Add(&events_); }
+  static void Output(const size_t bytes) { Add(&output_bytes_, bytes); }
+  // Counts the runs that --repeat has completed.
+  static void Run() { Add(&runs_); }
+  // Counts the connections that --retry has made again.
+  static void Retry() { Add(&retries_); }
+  // Polls for the mainloop, so as to count how often it wakes up.
+  static int Poll(pollfd *const fds, const unsigned long nfds,
+                  const int timeout, void *) {
+    Add(&wakeups_);
+    return poll(fds, nfds, timeout);
+  }
+  // The report goes to stderr, or if path is not empty, replaces the file
+  // there, as node_exporter's textfile collector expects.
+  static void Start(std::string path) { path_.emplace(std::move(path)); }
+  static void Report() {
+    if (!path_) return;
+    const std::string text = Format();
+    if (path_->empty()) {
+      fputs(text.c_str(), stderr);
+      return;
+    }
+    const std::string tmp = absl::StrCat(*path_, ".", getpid());
+    const int fd =
+        open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return perror(tmp.c_str());
+    const bool ok = write(fd, text.data(), text.size()) ==
+                    static_cast<ssize_t>(text.size());
+    if (close(fd) != 0 || !ok || rename(tmp.c_str(), path_->c_str()) != 0) {
+      perror(path_->c_str());
+      unlink(tmp.c_str());
+    }
+  }
+
+ private:
+  // Upper bounds in nanoseconds; the last bucket is everything slower.
+  static inline constexpr int64_t kBucketsNs[] = {
+      100000,   250000,   500000,    1000000,   2500000,   5000000,
+      10000000, 25000000, 50000000, 100000000, 250000000, 1000000000};
+  static inline constexpr const char *kOpNames[kNumOps] = {
+      "get_info", "set_volume", "set_mute", "get_server_info", "subscribe"};
+  using Counter = std::atomic<uint64_t>;
+  struct Histogram {
+    Counter buckets[std::size(kBucketsNs) + 1];
+    Counter sum_ns;
+  };
+
+  static void Add(Counter *const counter, const uint64_t n = 1) {
+    counter->fetch_add(n, std::memory_order_relaxed);
+  }
+  static uint64_t Get(const Counter &counter) {
+    return counter.load(std::memory_order_relaxed);
+  }
+  // Each metric's lines are together, after its TYPE line, as the text
+  // format requires.
+  static std::string Format() {
+    std::string text = "# TYPE paknob_requests_total counter\n";
+    for (int op = 0; op < kNumOps; ++op) {
+      absl::StrAppendFormat(
+          &text,
+          "paknob_requests_total{op=\"%s\",from=\"server\"} %d\n"
+          "paknob_requests_total{op=\"%s\",from=\"cache\"} %d\n",
+          kOpNames[op], Get(requests_[op]), kOpNames[op],
+          Get(cache_hits_[op]));
+    }
+    // Only requests the server answered are timed.
+    absl::StrAppend(&text, "# TYPE paknob_request_seconds histogram\n");
+    for (int op = 0; op < kNumOps; ++op) {
+      const Histogram &h = latency_[op];
+      uint64_t count = 0;
+      for (size_t i = 0; i < std::size(h.buckets); ++i) {
+        count += Get(h.buckets[i]);
+        const std::string le = i < std::size(kBucketsNs)
+                                   ? absl::StrCat(kBucketsNs[i] / 1e9)
+                                   : "+Inf";
+        absl::StrAppendFormat(
+            &text, "paknob_request_seconds_bucket{op=\"%s\",le=\"%s\"} %d\n",
+            kOpNames[op], le, count);
+      }
+      absl::StrAppendFormat(&text,
+                            "paknob_request_seconds_sum{op=\"%s\"} %g\n"
+                            "paknob_request_seconds_count{op=\"%s\"} %d\n",
+                            kOpNames[op], Get(h.sum_ns) / 1e9, kOpNames[op],
+                            count);
+    }
+    absl::StrAppendFormat(&text,
+                          "# TYPE paknob_events_total counter\n"
+                          "paknob_events_total %d\n"
+                          "# TYPE paknob_output_bytes_total counter\n"
+                          "paknob_output_bytes_total %d\n"
+                          "# TYPE paknob_mainloop_wakeups_total counter\n"
+                          "paknob_mainloop_wakeups_total %d\n"
+                          "# TYPE paknob_runs_total counter\n"
+                          "paknob_runs_total %d\n"
+                          "# TYPE paknob_retries_total counter\n"
+                          "paknob_retries_total %d\n",
+                          Get(events_), Get(output_bytes_), Get(wakeups_),
+                          Get(runs_), Get(retries_));
+    return text;
+  }
+
+  static inline std::optional<std::string> path_;
+  static inline Counter requests_[kNumOps];
+  static inline Counter cache_hits_[kNumOps];
+  static inline Histogram latency_[kNumOps];
+  static inline Counter events_;
+  static inline Counter output_bytes_;
+  static inline Counter wakeups_;
+  static inline Counter retries_;
+  static inline Counter runs_;
+};
+
+// Stands between subcommands and the server, so that requests can be counted
+// and timed, what the server says can be recorded with --record, and played
+// back without a server with --replay. Every request, and every callback
+// registration, goes through here.
+class Server {
+ public:
+  ~Server() {
+    if (file_) fclose(file_);
+  }
+  // Appends each state change, reply and event to a new file at path.
+  static bool Record(const std::string &path) {
+    FILE *const file = fopen(path.c_str(), "we");
+    if (!file) {
+      perror(path.c_str());
+      return false;
+    }
+    server_.reset(new Server(nullptr));
+    server_->file_ = file;
+    fwrite(kMagic, 1, sizeof(kMagic), file);
+    return true;
+  }
+  // Finishes a recording, if one is being made. Called before exiting.
+  static void Close() {
+    if (recording()) server_.reset();
+  }
+  // Plays back a recording in place of a connection. Replies go to requests
+  // in the order both were made, and unless realtime, as soon as there is a
+  // request for them.
+  static bool Replay(pa_mainloop_api *const api, const std::string &path,
+                     const bool realtime) {
+    std::unique_ptr<Server> server(new Server(api));
+    server->realtime_ = realtime;
+    if (!server->Load(path)) return false;
+    server_ = std::move(server);
+    return true;
+  }
+  // Stands in for an operation whose reply comes from somewhere other than
+  // libpulse, like a recording, and so has no reference to drop.
+  static pa_operation *Synthetic() { return kSynthetic; }
+  static bool IsSynthetic(const pa_operation *const op) {
+    return op && op == kSynthetic;
+  }
+
+  // Requests taking one argument and a callback for the reply, like
+  // pa_context_get_sink_info_by_name.
+  template <auto kRequest, typename Arg, typename Callback>
+  static pa_operation *Get(pa_context *const ctx, const Arg arg,
+                           const Callback cb, void *const userdata) {
+    constexpr Stats::Op op = std::is_same_v<Callback, pa_context_success_cb_t>
+                                 ? Stats::kSubscribe
+                                 : Stats::kGetInfo;
+    return Request(op, cb, userdata,
+                   [&](const Callback cb, void *const userdata) {
+                     return kRequest(ctx, arg, cb, userdata);
+                   });
+  }
+  // Requests that set something on a named object, like
+  // pa_context_set_sink_mute_by_name.
+  template <auto kRequest, typename Value>
+  static pa_operation *Set(pa_context *const ctx, const char *const name,
+                           const Value value, const pa_context_success_cb_t cb,
+                           void *const userdata) {
+    constexpr Stats::Op op =
+        std::is_same_v<Value, int> ? Stats::kSetMute : Stats::kSetVolume;
+    return Request(op, cb, userdata,
+                   [&](const pa_context_success_cb_t cb, void *const userdata) {
+                     return kRequest(ctx, name, value, cb, userdata);
+                   });
+  }
+  static pa_operation *GetServerInfo(pa_context *const ctx,
+                                     const pa_server_info_cb_t cb,
+                                     void *const userdata) {
+    return Request(Stats::kGetServerInfo, cb, userdata,
+                   [&](const pa_server_info_cb_t cb, void *const userdata) {
+                     return pa_context_get_server_info(ctx, cb, userdata);
+                   });
+  }
+  static pa_operation *Subscribe(pa_context *const ctx,
+                                 const pa_subscription_mask_t mask,
+                                 const pa_context_success_cb_t cb,
+                                 void *const userdata) {
+    return Get<pa_context_subscribe>(ctx, mask, cb, userdata);
+  }
+  static void SetSubscribeCallback(pa_context *const ctx,
+                                   const pa_context_subscribe_cb_t cb,
+                                   void *const userdata) {
+    subscribe_cb_ = {cb, userdata};
+    if (!replaying()) pa_context_set_subscribe_callback(ctx, EventCB, nullptr);
+  }
+  static void SetStateCallback(pa_context *const ctx,
+                               const pa_context_notify_cb_t cb,
+                               void *const userdata) {
+    state_cb_ = {cb, userdata};
+    if (!replaying()) pa_context_set_state_callback(ctx, StateCB, nullptr);
+  }
+  static pa_context_state_t GetState(pa_context *const ctx) {
+    if (!replaying()) return pa_context_get_state(ctx);
+    return server_->state_;
+  }
+  static int Connect(pa_context *const ctx, const pa_context_flags_t flags) {
+    if (!replaying())
+      return pa_context_connect(ctx, /* server = */ nullptr, flags,
+                                /* api = */ nullptr);
+    server_->ctx_ = ctx;
+    server_->start_ = Now();
+    server_->defer_ = server_->api_->defer_new(server_->api_, DeferCB, nullptr);
+    return server_->defer_ ? 0 : -1;
+  }
+  static bool IsPending(pa_context *const ctx) {
+    return !replaying() && pa_context_is_pending(ctx);
+  }
+  // A replay ends when the recording does.
+  static void Disconnect(pa_context *const ctx) {
+    if (!replaying()) pa_context_disconnect(ctx);
+  }
+
+ private:
+  static inline constexpr char kMagic[] = {'p', 'a', 'k', 'n', 'o', 'b', 2};
+  static inline char synthetic_op_;
+  static inline pa_operation *const kSynthetic =
+      reinterpret_cast<pa_operation *>(&synthetic_op_);
+
+  enum Kind : uint8_t {
+    kState,
+    kEvent,
+    kSuccess,
+    kSinkInfo,
+    kSourceInfo,
+    kServerInfo,
+  };
+  // One thing the server said, and when relative to connecting.
+  struct Entry {
+    Kind kind = kState;
+    int64_t ns = 0;
+    // The state, event type, success, end of list flag, or whether there is
+    // server info.
+    int32_t value = 0;
+    // The index of the object the event or info is about.
+    uint32_t index = 0;
+    bool mute = false;
+    pa_cvolume volume = {};
+    pa_channel_map channel_map = {};
+    uint32_t flags = 0;
+    pa_volume_t base_volume = PA_VOLUME_NORM;
+    // The info's name, or the server's default sink and source.
+    std::string name;
+    std::string source_name;
+  };
+  template <typename Callback>
+  struct Call {
+    Callback cb;
+    void *userdata;
+    Stats::Op op;
+    int64_t start;
+  };
+  // A replayed request waiting for its reply. Delivering an entry returns
+  // true once the reply is complete.
+  struct Pending {
+    Kind kind;
+    absl::AnyInvocable<bool(pa_context *, const Entry &)> deliver;
+  };
+  template <typename InfoT>
+  using InfoCallback = void (*)(pa_context *, const InfoT *, int, void *);
+
+  explicit Server(pa_mainloop_api *const api) : api_{api} {}
+  static int64_t Now() { return Stats::Now(); }
+  static bool replaying() { return server_ && server_->api_; }
+  static bool recording() { return server_ && server_->file_; }
+
+  template <typename Callback, typename Send>
+  static pa_operation *Request(const Stats::Op op, const Callback cb,
+                               void *const userdata, Send send) {
+    Stats::Request(op);
+    if (replaying()) {
+      server_->pending_.push_back(
+          {KindOf(cb), [cb, userdata](pa_context *const ctx, const Entry &e) {
+             return Deliver(ctx, e, cb, userdata);
+           }});
+      if (server_->defer_)
+        server_->api_->defer_enable(server_->defer_, 1);
+      return kSynthetic;
+    }
+    const auto call = new Call<Callback>{cb, userdata, op, Now()};
+    pa_operation *const o = send(Trampoline(cb), call);
+    if (!o) delete call;
+    return o;
+  }
+
+  static Kind KindOf(pa_context_success_cb_t) { return kSuccess; }
+  static Kind KindOf(pa_sink_info_cb_t) { return kSinkInfo; }
+  static Kind KindOf(pa_source_info_cb_t) { return kSourceInfo; }
+  static Kind KindOf(pa_server_info_cb_t) { return kServerInfo; }
+
+  // Unless replaying, each reply passes through one of these on its way to
+  // the subcommand's callback.
+  static pa_context_success_cb_t Trampoline(pa_context_success_cb_t) {
+    return SuccessCB;
+  }
+  template <typename InfoT>
+  static InfoCallback<InfoT> Trampoline(InfoCallback<InfoT>) {
+    return InfoCB<InfoT>;
+  }
+  static pa_server_info_cb_t Trampoline(pa_server_info_cb_t) {
+    return ServerInfoCB;
+  }
+  static void SuccessCB(pa_context *const ctx, const int success,
+                        void *const userdata) {
+    const std::unique_ptr<Call<pa_context_success_cb_t>> call(
+        reinterpret_cast<Call<pa_context_success_cb_t> *>(userdata));
+    Stats::Reply(call->op, Now() - call->start);
+    if (recording()) {
+      Entry e;
+      e.kind = kSuccess;
+      e.value = success;
+      server_->Write(&e);
+    }
+    if (call->cb) call->cb(ctx, success, call->userdata);
+  }
+  template <typename InfoT>
+  static void InfoCB(pa_context *const ctx, const InfoT *const info,
+                     const int is_last, void *const userdata) {
+    const auto call = reinterpret_cast<Call<InfoCallback<InfoT>> *>(userdata);
+    if (recording()) {
+      Entry e;
+      e.kind = KindOf(InfoCallback<InfoT>{});
+      e.value = is_last;
+      if (!is_last) {
+        e.index = info->index;
+        e.mute = info->mute;
+        e.volume = info->volume;
+        e.channel_map = info->channel_map;
+        e.flags = info->flags;
+        e.base_volume = info->base_volume;
+        e.name = info->name ? info->name : "";
+      }
+      server_->Write(&e);
+    }
+    if (is_last) Stats::Reply(call->op, Now() - call->start);
+    call->cb(ctx, info, is_last, call->userdata);
+    if (is_last) delete call;
+  }
+  static void ServerInfoCB(pa_context *const ctx,
+                           const pa_server_info *const info,
+                           void *const userdata) {
+    const std::unique_ptr<Call<pa_server_info_cb_t>> call(
+        reinterpret_cast<Call<pa_server_info_cb_t> *>(userdata));
+    Stats::Reply(call->op, Now() - call->start);
+    if (recording()) {
+      Entry e;
+      e.kind = kServerInfo;
+      e.value = info != nullptr;
+      if (info && info->default_sink_name) e.name = info->default_sink_name;
+      if (info && info->default_source_name)
+        e.source_name = info->default_source_name;
+      server_->Write(&e);
+    }
+    call->cb(ctx, info, call->userdata);
+  }
+  static void EventCB(pa_context *const ctx,
+                      const pa_subscription_event_type_t type,
+                      const uint32_t idx, void *) {
+    Stats::Event();
+    if (recording()) {
+      Entry e;
+      e.kind = kEvent;
+      e.value = type;
+      e.index = idx;
+      server_->Write(&e);
+    }
+    const auto &[cb, userdata] = subscribe_cb_;
+    if (cb) cb(ctx, type, idx, userdata);
+  }
+  static void StateCB(pa_context *const ctx, void *) {
+    if (recording()) {
+      Entry e;
+      e.kind = kState;
+      e.value = pa_context_get_state(ctx);
+      server_->Write(&e);
+    }
+    const auto &[cb, userdata] = state_cb_;
+    if (cb) cb(ctx, userdata);
+  }
+
+  // While replaying, these turn each entry back into what libpulse would
+  // have passed.
+  static bool Deliver(pa_context *const ctx, const Entry &e,
+                      const pa_context_success_cb_t cb, void *const userdata) {
+    if (cb) cb(ctx, e.value, userdata);
+    return true;
+  }
+  template <typename InfoT>
+  static bool Deliver(pa_context *const ctx, const Entry &e,
+                      const InfoCallback<InfoT> cb, void *const userdata) {
+    if (e.value) {
+      cb(ctx, nullptr, e.value, userdata);
+      return true;
+    }
+    InfoT info = {};
+    info.index = e.index;
+    info.name = e.name.c_str();
+    info.volume = e.volume;
+    info.channel_map = e.channel_map;
+    info.mute = e.mute;
+    info.flags = static_cast<decltype(info.flags)>(e.flags);
+    info.base_volume = e.base_volume;
+    cb(ctx, &info, 0, userdata);
+    return false;
+  }
+  static bool Deliver(pa_context *const ctx, const Entry &e,
+                      const pa_server_info_cb_t cb, void *const userdata) {
+    pa_server_info info = {};
+    if (!e.name.empty()) info.default_sink_name = e.name.c_str();
+    if (!e.source_name.empty())
+      info.default_source_name = e.source_name.c_str();
+    cb(ctx, e.value ? &info : nullptr, userdata);
+    return true;
+  }
+
+  template <typename T>
+  static void Put(std::string *const out, const T value) {
+    out->append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+  static void PutString(std::string *const out, const absl::string_view s) {
+    Put(out, static_cast<uint16_t>(std::min<size_t>(s.size(), UINT16_MAX)));
+    out->append(s.data(), std::min<size_t>(s.size(), UINT16_MAX));
+  }
+  template <typename T>
+  static bool Get(absl::string_view *const in, T *const value) {
+    if (in->size() < sizeof(*value)) return false;
+    memcpy(value, in->data(), sizeof(*value));
+    in->remove_prefix(sizeof(*value));
+    return true;
+  }
+  static bool GetString(absl::string_view *const in, std::string *const s) {
+    uint16_t size;
+    if (!Get(in, &size) || in->size() < size) return false;
+    s->assign(in->data(), size);
+    in->remove_prefix(size);
+    return true;
+  }
+
+  // Entries are the kind, time and value, then whatever else the kind has.
+  void Write(Entry *const e) {
+    e->ns = Now() - start_;
+    std::string out;
+    Put(&out, e->kind);
+    Put(&out, e->ns);
+    Put(&out, e->value);
+    switch (e->kind) {
+      case kEvent:
+        Put(&out, e->index);
+        break;
+      case kSinkInfo:
+      case kSourceInfo:
+        if (e->value) break;
+        Put(&out, e->index);
+        Put(&out, static_cast<uint8_t>(e->mute));
+        Put(&out, e->volume.channels);
+        for (int i = 0; i < e->volume.channels; ++i)
+          Put(&out, e->volume.values[i]);
+        Put(&out, e->channel_map.channels);
+        for (int i = 0; i < e->channel_map.channels; ++i)
+          Put(&out, static_cast<int8_t>(e->channel_map.map[i]));
+        Put(&out, e->flags);
+        Put(&out, e->base_volume);
+        PutString(&out, e->name);
+        break;
+      case kServerInfo:
+        if (!e->value) break;
+        PutString(&out, e->name);
+        PutString(&out, e->source_name);
+        break;
+      default:
+        break;
+    }
+    // Resident subcommands may well be killed, so nothing is left buffered.
+    fwrite(out.data(), 1, out.size(), file_);
+    fflush(file_);
+  }
+  bool Read(absl::string_view *const in, Entry *const e) {
+    if (!Get(in, &e->kind) || !Get(in, &e->ns) || !Get(in, &e->value))
+      return false;
+    switch (e->kind) {
+      case kState:
+      case kSuccess:
+        return true;
+      case kEvent:
+        return Get(in, &e->index);
+      case kSinkInfo:
+      case kSourceInfo: {
+        if (e->value) return true;
+        uint8_t mute;
+        if (!Get(in, &e->index) || !Get(in, &mute) ||
+            !Get(in, &e->volume.channels) ||
+            e->volume.channels > PA_CHANNELS_MAX)
+          return false;
+        e->mute = mute;
+        for (int i = 0; i < e->volume.channels; ++i)
+          if (!Get(in, &e->volume.values[i])) return false;
+        if (!Get(in, &e->channel_map.channels) ||
+            e->channel_map.channels > PA_CHANNELS_MAX)
+          return false;
+        for (int i = 0; i < e->channel_map.channels; ++i) {
+          int8_t position;
+          if (!Get(in, &position)) return false;
+          e->channel_map.map[i] = static_cast<pa_channel_position_t>(position);
+        }
+        return Get(in, &e->flags) && Get(in, &e->base_volume) &&
+               GetString(in, &e->name);
+      }
+      case kServerInfo:
+        return !e->value ||
+               (GetString(in, &e->name) && GetString(in, &e->source_name));
+      default:
+        return false;
+    }
+  }
+  bool Load(const std::string &path) {
+    FILE *const file = fopen(path.c_str(), "re");
+    if (!file) {
+      perror(path.c_str());
+      return false;
+    }
+    std::string data;
+    char buf[4096];
+    for (size_t n; (n = fread(buf, 1, sizeof(buf), file)) > 0;)
+      data.append(buf, n);
+    fclose(file);
+    absl::string_view in = data;
+    if (!absl::ConsumePrefix(&in, {kMagic, sizeof(kMagic)})) {
+      absl::FPrintF(stderr, "%s: not a recording by this version of paknob\n",
+                    path);
+      return false;
+    }
+    while (!in.empty()) {
+      Entry e;
+      if (!Read(&in, &e)) {
+        absl::FPrintF(stderr, "%s: truncated\n", path);
+        return false;
+      }
+      entries_.push_back(std::move(e));
+    }
+    return true;
+  }
+
+  static void DeferCB(pa_mainloop_api *const api, pa_defer_event *const defer,
+                      void *) {
+    api->defer_enable(defer, 0);
+    server_->Play();
+  }
+  static void TimerCB(pa_mainloop_api *const api, pa_time_event *const timer,
+                      const timeval *, void *) {
+    api->time_free(timer);
+    server_->timer_ = nullptr;
+    server_->Play();
+  }
+  // Delivers the next entry, one per mainloop iteration so that a subcommand
+  // that quits sees no more.
+  void Play() {
+    if (next_ == entries_.size()) return api_->quit(api_, EXIT_SUCCESS);
+    const Entry &e = entries_[next_];
+    if (realtime_ && e.ns > Now() - start_) {
+      if (timer_) return;
+      timeval tv;
+      pa_timeval_add(pa_gettimeofday(&tv), (e.ns - (Now() - start_)) / 1000);
+      timer_ = api_->time_new(api_, &tv, TimerCB, nullptr);
+      return;
+    }
+    switch (e.kind) {
+      case kState:
+        ++next_;
+        state_ = static_cast<pa_context_state_t>(e.value);
+        if (state_cb_.first) state_cb_.first(ctx_, state_cb_.second);
+        break;
+      case kEvent:
+        ++next_;
+        if (subscribe_cb_.first)
+          subscribe_cb_.first(
+              ctx_, static_cast<pa_subscription_event_type_t>(e.value),
+              e.index, subscribe_cb_.second);
+        break;
+      default:
+        // Wait for the request this replies to.
+        if (pending_.empty()) return;
+        if (pending_.front().kind != e.kind) {
+          absl::FPrintF(stderr, "replay: entry %d answers another request\n",
+                        next_);
+          return api_->quit(api_, EXIT_FAILURE);
+        }
+        ++next_;
+        if (pending_.front().deliver(ctx_, e)) pending_.pop_front();
+        break;
+    }
+    api_->defer_enable(defer_, 1);
+  }
+
+  // There is only ever one context.
+  static inline std::pair<pa_context_subscribe_cb_t, void *> subscribe_cb_;
+  static inline std::pair<pa_context_notify_cb_t, void *> state_cb_;
+  static inline std::unique_ptr<Server> server_;
+  // Set when replaying.
+  pa_mainloop_api *const api_;
+  FILE *file_ = nullptr;
+  int64_t start_ = Now();
+  bool realtime_ = false;
+  pa_context *ctx_ = nullptr;
+  pa_context_state_t state_ = PA_CONTEXT_UNCONNECTED;
+  std::vector<Entry> entries_;
+  size_t next_ = 0;
+  std::deque<Pending> pending_;
+  pa_defer_event *defer_ = nullptr;
+  pa_time_event *timer_ = nullptr;
+};
+
 using UniqueOperation =
     std::unique_ptr<pa_operation, absl::AnyInvocable<void(pa_operation *)>>;
 UniqueOperation WrapUniqueOperation(pa_operation *const op) {
+  if (Server::IsSynthetic(op))
+    return UniqueOperation(op, [](pa_operation *) {});
+  Watchdog::Watch(op);
   return UniqueOperation(op, [](pa_operation *const op) {
     if (op) pa_operation_unref(op);
   });
 }
 
+// Keeps the default sink's and source's info current in a resident process,
+// so that requests for them are answered without asking the server. Events
+// for either, or for the server (whose default may have changed), drop the
+// cached info until it is fetched again; until then requests go to the
+// server as usual.
+class InfoCache {
+ public:
+  template <typename InfoT>
+  using InfoCallback = void (*)(pa_context *, const InfoT *, int, void *);
+
+  static void Start(pa_mainloop_api *const api, pa_context *const ctx) {
+    cache_.reset(new InfoCache(api, ctx));
+    Server::SetSubscribeCallback(ctx, SubscribeCB, nullptr);
+    WrapUniqueOperation(Server::Subscribe(
+        ctx,
+        static_cast<pa_subscription_mask_t>(PA_SUBSCRIPTION_MASK_SINK |
+                                            PA_SUBSCRIPTION_MASK_SOURCE |
+                                            PA_SUBSCRIPTION_MASK_SERVER),
+        nullptr, nullptr));
+    cache_->Fetch(cache_->sink_);
+    cache_->Fetch(cache_->source_);
+  }
+  // Forgets everything, for when the connection is lost.
+  static void Stop() { cache_.reset(); }
+  // Like pa_context_get_sink_info_by_name, but answered from the cache when
+  // it can be. The reply still comes from the mainloop, as libpulse's would.
+  template <auto kRequest, typename InfoT>
+  static pa_operation *Get(pa_context *const ctx, const char *const name,
+                           const InfoCallback<InfoT> cb, void *const userdata) {
+    if (!cache_) return Server::Get<kRequest>(ctx, name, cb, userdata);
+    const auto &slot = cache_->slot<InfoT>();
+    if (!slot.info || strcmp(name, slot.default_name) != 0)
+      return Server::Get<kRequest>(ctx, name, cb, userdata);
+    auto reply =
+        std::make_unique<Reply<InfoT>>(Reply<InfoT>{ctx, cb, userdata, slot});
+    pa_mainloop_api_once(cache_->api_, ReplyCB<InfoT>, reply.release());
+    Stats::CacheHit(Stats::kGetInfo);
+    return Server::Synthetic();
+  }
+  // Like pa_context_set_sink_volume_by_name or _mute_by_name. Writes to a
+  // cached device update the cache at once, so that the next write builds
+  // on this one, and writes that would change nothing are not sent at all.
+  // A failed write drops the entry.
+  template <auto kRequest, typename InfoT, typename Value>
+  static pa_operation *Set(pa_context *const ctx, const char *const name,
+                           const Value value, const pa_context_success_cb_t cb,
+                           void *const userdata) {
+    if (!cache_) return Server::Set<kRequest>(ctx, name, value, cb, userdata);
+    auto &slot = cache_->slot<InfoT>();
+    if (!slot.info || strcmp(name, slot.default_name) != 0)
+      return Server::Set<kRequest>(ctx, name, value, cb, userdata);
+    auto write = std::make_unique<Write>(Write{ctx, cb, userdata});
+    if (!Update(&*slot.info, value)) {
+      pa_mainloop_api_once(cache_->api_, UnchangedCB, write.release());
+      Stats::CacheHit(std::is_same_v<Value, int> ? Stats::kSetMute
+                                                 : Stats::kSetVolume);
+      return Server::Synthetic();
+    }
+    pa_operation *const op = Server::Set<kRequest>(ctx, name, value,
+                                                   WriteCB<InfoT>, write.get());
+    if (!op) {
+      cache_->Fetch(slot);
+      return nullptr;
+    }
+    write.release();
+    return op;
+  }
+
+ private:
+  // What is known about one default device. The info's strings are all null
+  // but for the name, which points into the slot.
+  template <typename InfoT>
+  struct Slot {
+    const char *const default_name;
+    std::optional<InfoT> info;
+    std::string name;
+    bool fetching;
+    // Whether it changed again while being fetched.
+    bool stale;
+  };
+  struct Write {
+    pa_context *const ctx;
+    const pa_context_success_cb_t cb;
+    void *const userdata;
+  };
+  template <typename InfoT>
+  struct Reply {
+    pa_context *const ctx;
+    const InfoCallback<InfoT> cb;
+    void *const userdata;
+    Slot<InfoT> slot;
+  };
+
+  explicit InfoCache(pa_mainloop_api *const api, pa_context *const ctx)
+      : api_{api},
+        ctx_{ctx},
+        sink_{"@DEFAULT_SINK@", std::nullopt, {}, false, false},
+        source_{"@DEFAULT_SOURCE@", std::nullopt, {}, false, false} {}
+  template <typename InfoT>
+  Slot<InfoT> &slot() {
+    if constexpr (std::is_same_v<InfoT, pa_sink_info>)
+      return sink_;
+    else
+      return source_;
+  }
+  template <typename InfoT>
+  static void ReplyCB(pa_mainloop_api *, void *const userdata) {
+    const std::unique_ptr<Reply<InfoT>> reply(
+        reinterpret_cast<Reply<InfoT> *>(userdata));
+    InfoT info = *reply->slot.info;
+    info.name = reply->slot.name.c_str();
+    reply->cb(reply->ctx, &info, 0, reply->userdata);
+    reply->cb(reply->ctx, nullptr, 1, reply->userdata);
+  }
+  // Returns false if nothing would change.
+  template <typename InfoT>
+  static bool Update(InfoT *const info, const pa_cvolume *const cv) {
+    if (pa_cvolume_equal(&info->volume, cv)) return false;
+    info->volume = *cv;
+    return true;
+  }
+  template <typename InfoT>
+  static bool Update(InfoT *const info, const int mute) {
+    if (!info->mute == !mute) return false;
+    info->mute = mute;
+    return true;
+  }
+  static void UnchangedCB(pa_mainloop_api *, void *const userdata) {
+    const std::unique_ptr<Write> write(reinterpret_cast<Write *>(userdata));
+    if (write->cb) write->cb(write->ctx, 1, write->userdata);
+  }
+  template <typename InfoT>
+  static void WriteCB(pa_context *const ctx, const int success,
+                      void *const userdata) {
+    const std::unique_ptr<Write> write(reinterpret_cast<Write *>(userdata));
+    if (!success) cache_->Fetch(cache_->slot<InfoT>());
+    if (write->cb) write->cb(ctx, success, write->userdata);
+  }
+  template <typename InfoT>
+  void Fetch(Slot<InfoT> &slot) {
+    slot.info.reset();
+    if (slot.fetching) {
+      slot.stale = true;
+      return;
+    }
+    if constexpr (std::is_same_v<InfoT, pa_sink_info>) {
+      slot.fetching = static_cast<bool>(WrapUniqueOperation(
+          Server::Get<pa_context_get_sink_info_by_name>(
+              ctx_, slot.default_name, FetchCB<pa_sink_info>, nullptr)));
+    } else {
+      slot.fetching = static_cast<bool>(WrapUniqueOperation(
+          Server::Get<pa_context_get_source_info_by_name>(
+              ctx_, slot.default_name, FetchCB<pa_source_info>, nullptr)));
+    }
+  }
+  template <typename InfoT>
+  static void FetchCB(pa_context *, const InfoT *const info, const int is_last,
+                      void *) {
+    auto &slot = cache_->slot<InfoT>();
+    if (!is_last) {
+      InfoT copy = {};
+      copy.index = info->index;
+      copy.volume = info->volume;
+      copy.channel_map = info->channel_map;
+      copy.mute = info->mute;
+      copy.flags = info->flags;
+      copy.base_volume = info->base_volume;
+      slot.info = copy;
+      slot.name = info->name ? info->name : "";
+      return;
+    }
+    slot.fetching = false;
+    if (is_last < 0) slot.info.reset();
+    if (!slot.stale) return;
+    slot.stale = false;
+    cache_->Fetch(slot);
+  }
+  static void SubscribeCB(pa_context *, const pa_subscription_event_type_t type,
+                          const uint32_t idx, void *) {
+    auto &sink = cache_->sink_;
+    auto &source = cache_->source_;
+    switch (type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+      case PA_SUBSCRIPTION_EVENT_SINK:
+        if (sink.fetching || (sink.info && sink.info->index == idx))
+          cache_->Fetch(sink);
+        break;
+      case PA_SUBSCRIPTION_EVENT_SOURCE:
+        if (source.fetching || (source.info && source.info->index == idx))
+          cache_->Fetch(source);
+        break;
+      case PA_SUBSCRIPTION_EVENT_SERVER:
+        cache_->Fetch(sink);
+        cache_->Fetch(source);
+        break;
+    }
+  }
+
+  static inline std::unique_ptr<InfoCache> cache_;
+  pa_mainloop_api *const api_;
+  pa_context *const ctx_;
+  Slot<pa_sink_info> sink_;
+  Slot<pa_source_info> source_;
+};
+
+// Returns the path of a file in the runtime directory, or an empty string if
+// there is none.
+std::string RuntimePath(const absl::string_view name) {
+  const char *const dir = getenv("XDG_RUNTIME_DIR");
+  if (!dir || !*dir) return {};
+  return absl::StrCat(dir, "/", name);
+}
+
+// Records when each phase of a run ended, for --trace. Marking is a no-op
+// unless tracing has been started.
+class Tracer {
+ public:
+  // The report goes to stderr, or if path is not empty, is appended to it as
+  // one JSON record per run.
+  static void Start(std::string path, std::string command) {
+    tracer_.reset(new Tracer(std::move(path), std::move(command)));
+  }
+  static void Mark(const char *const phase) {
+    if (!tracer_ || tracer_->phases_.size() >= kMaxPhases) return;
+    tracer_->phases_.push_back({phase, Now(CLOCK_MONOTONIC)});
+  }
+  static void Report(const int ret) {
+    if (!tracer_) return;
+    Mark("exit");
+    tracer_->Write(ret);
+  }
+  // Notes when the program was loaded. Runs before static initialization.
+  static void Loaded() { loaded_ = Now(CLOCK_MONOTONIC); }
+
+ private:
+  static inline constexpr size_t kMaxPhases = 1024;
+  struct Phase {
+    const char *name;
+    int64_t ns;
+  };
+
+  // The first phases are the kernel's exec and dynamic linking, up to when
+  // the program was loaded, and static initialization and argument parsing
+  // after that, where these can be told.
+  explicit Tracer(std::string path, std::string command)
+      : path_{std::move(path)},
+        command_{std::move(command)},
+        start_{ProcessStart()},
+        start_unix_{Now(CLOCK_REALTIME) - (Now(CLOCK_MONOTONIC) - start_)} {
+    if (loaded_ && loaded_ >= start_) phases_.push_back({"exec", loaded_});
+    phases_.push_back({"init", Now(CLOCK_MONOTONIC)});
+  }
+  static int64_t Now(const clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return int64_t{ts.tv_sec} * 1000000000 + ts.tv_nsec;
+  }
+  // When the kernel started the process, from its start time since boot,
+  // which is only as precise as a clock tick; failing that, when the
+  // program was loaded, or now.
+  static int64_t ProcessStart() {
+    const int64_t fallback = loaded_ ? loaded_ : Now(CLOCK_MONOTONIC);
+    char buf[1024];
+    const int fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return fallback;
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (n <= 0) return fallback;
+    // The command name may hold anything, so fields are counted from its
+    // end; starttime is the 22nd field, and the name the 2nd.
+    const absl::string_view stat(buf, n);
+    const size_t paren = stat.rfind(')');
+    if (paren == absl::string_view::npos) return fallback;
+    const std::vector<absl::string_view> fields = absl::StrSplit(
+        stat.substr(paren + 1), ' ', absl::SkipEmpty());
+    const long ticks = sysconf(_SC_CLK_TCK);
+    uint64_t start;
+    if (fields.size() < 20 || ticks <= 0 ||
+        !absl::SimpleAtoi(fields[19], &start))
+      return fallback;
+    const int64_t age =
+        Now(CLOCK_BOOTTIME) - static_cast<int64_t>(start * 1000000000 / ticks);
+    if (age < 0) return fallback;
+    return Now(CLOCK_MONOTONIC) - age;
+  }
+  static std::string JsonString(const absl::string_view s) {
+    std::string json = "\"";
+    for (const char c : s) {
+      if (c == '"' || c == '\\')
+        absl::StrAppend(&json, "\\", absl::string_view(&c, 1));
+      else if (static_cast<unsigned char>(c) < 0x20)
+        absl::StrAppendFormat(&json, "\\u%04x", c);
+      else
+        json.push_back(c);
+    }
+    json.push_back('"');
+    return json;
+  }
+  void Write(const int ret) const {
+    const int64_t total = phases_.back().ns - start_;
+    if (path_.empty()) {
+      int64_t prev = start_;
+      for (const auto &phase : phases_) {
+        absl::FPrintF(stderr, "%-14s %10.3f ms\n", phase.name,
+                      (phase.ns - prev) / 1e6);
+        prev = phase.ns;
+      }
+      absl::FPrintF(stderr, "%-14s %10.3f ms\n", "total", total / 1e6);
+      return;
+    }
+    std::string json = absl::StrFormat(
+        "{\"command\":%s,\"exit\":%d,\"start_unix_ns\":%d,\"phases\":[",
+        JsonString(command_), ret, start_unix_);
+    int64_t prev = start_;
+    for (const auto &phase : phases_) {
+      absl::StrAppendFormat(&json, "%s[%s,%d]",
+                            &phase == &phases_.front() ? "" : ",",
+                            JsonString(phase.name), phase.ns - prev);
+      prev = phase.ns;
+    }
+    absl::StrAppendFormat(&json, "],\"total_ns\":%d}\n", total);
+    // A single write, so that concurrent runs don't interleave records.
+    const int fd =
+        open(path_.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    if (write(fd, json.data(), json.size()) < 0) perror(path_.c_str());
+    close(fd);
+  }
+
+  static inline std::unique_ptr<Tracer> tracer_;
+  static inline int64_t loaded_ = 0;
+  const std::string path_;
+  const std::string command_;
+  const int64_t start_;
+  const int64_t start_unix_;
+  std::vector<Phase> phases_;
+};
+// Runs before any static initializer, so that can be told from loading.
+[[gnu::used, gnu::section(".preinit_array")]] void (*const trace_loaded)() =
+    Tracer::Loaded;
+
 template <typename T>
 class Caster {
  public:
@@ -59,145 +1164,567 @@ class Caster {
 
 struct SinkTraits {
   using InfoT = pa_sink_info;
+  static inline constexpr char kKind[] = "sink";
   static inline constexpr char kDefaultName[] = "@DEFAULT_SINK@";
-  static inline constexpr auto GetInfo = pa_context_get_sink_info_by_name;
-  static inline constexpr auto SetVolume = pa_context_set_sink_volume_by_name;
-  static inline constexpr auto SetMute = pa_context_set_sink_mute_by_name;
+  // What PipeWire's "default" metadata calls it.
+  static inline constexpr char kMetadataKey[] = "default.audio.sink";
+  static inline constexpr auto GetInfo =
+      InfoCache::Get<pa_context_get_sink_info_by_name, pa_sink_info>;
+  static inline constexpr auto SetVolume =
+      InfoCache::Set<pa_context_set_sink_volume_by_name, pa_sink_info,
+                     const pa_cvolume *>;
+  static inline constexpr auto SetMute =
+      InfoCache::Set<pa_context_set_sink_mute_by_name, pa_sink_info, int>;
+  static inline constexpr auto kFacility = PA_SUBSCRIPTION_EVENT_SINK;
+  static inline constexpr auto kSubscriptionMask = PA_SUBSCRIPTION_MASK_SINK;
 };
 struct SourceTraits {
   using InfoT = pa_source_info;
+  static inline constexpr char kKind[] = "source";
   static inline constexpr char kDefaultName[] = "@DEFAULT_SOURCE@";
-  static inline constexpr auto GetInfo = pa_context_get_source_info_by_name;
-  static inline constexpr auto SetVolume = pa_context_set_source_volume_by_name;
-  static inline constexpr auto SetMute = pa_context_set_source_mute_by_name;
+  static inline constexpr char kMetadataKey[] = "default.audio.source";
+  static inline constexpr auto GetInfo =
+      InfoCache::Get<pa_context_get_source_info_by_name, pa_source_info>;
+  static inline constexpr auto SetVolume =
+      InfoCache::Set<pa_context_set_source_volume_by_name, pa_source_info,
+                     const pa_cvolume *>;
+  static inline constexpr auto SetMute =
+      InfoCache::Set<pa_context_set_source_mute_by_name, pa_source_info, int>;
+  static inline constexpr auto kFacility = PA_SUBSCRIPTION_EVENT_SOURCE;
+  static inline constexpr auto kSubscriptionMask = PA_SUBSCRIPTION_MASK_SOURCE;
 };
 
-class Subcommand {
+// Memory for a subcommand's coroutine frames. It is handed out from blocks
+// that are only freed together, with the subcommand, so that running a
+// coroutine costs no more allocations than the callbacks it replaces.
+class Arena {
  public:
-  static std::unique_ptr<Subcommand> Build(
-      const absl::Span<const absl::string_view> args);
-  virtual ~Subcommand() = default;
-  static std::string Usage(absl::string_view argv0);
-  virtual void Run(pa_context *) = 0;
-  void quit(int ret) { api_->quit(api_, ret); }
-  [[nodiscard]] pa_mainloop_api *api() const { return api_; }
-  void set_api(pa_mainloop_api *api) {
-    assert(!api_);
-    api_ = api;
+  void *Allocate(size_t size) {
+    size = (size + kAlign - 1) / kAlign * kAlign;
+    if (size > static_cast<size_t>(end_ - next_)) {
+      const size_t block = std::max(size, kBlockSize);
+      blocks_.push_back(std::make_unique<char[]>(block));
+      next_ = blocks_.back().get();
+      end_ = next_ + block;
+    }
+    void *const p = next_;
+    next_ += size;
+    return p;
   }
 
- protected:
-  Subcommand() : api_{nullptr} {}
-  static bool IsValid(absl::string_view name,
-                      absl::Span<const absl::string_view> &args) {
-    if (args.empty()) return false;
-    if (args.front() != name) return false;
-    args.remove_prefix(1);
-    return true;
-  }
-  static void Drain(pa_context *const ctx) {
-    if (!WrapUniqueOperation(pa_context_drain(ctx, DrainCB, nullptr)))
-      pa_context_disconnect(ctx);
+ private:
+  static inline constexpr size_t kAlign = alignof(std::max_align_t);
+  static inline constexpr size_t kBlockSize = 1024;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char *next_ = nullptr;
+  char *end_ = nullptr;
+};
+
+// A subcommand written as a coroutine, which runs until it first awaits a
+// reply as soon as it is called. Only member functions of a Subcommand can
+// be Tasks, since their frames come from its arena; the subcommand keeps the
+// Task, and must not be destroyed while it awaits.
+class Task {
+ public:
+  struct promise_type {
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+    template <typename Owner, typename... Args>
+    static void *operator new(const size_t size, Owner &owner, Args &...) {
+      return owner.arena().Allocate(size);
+    }
+    static void operator delete(void *) {}
+  };
+
+  Task() = default;
+  Task(Task &&other) noexcept : handle_{std::exchange(other.handle_, {})} {}
+  Task &operator=(Task &&other) noexcept {
+    std::swap(handle_, other.handle_);
+    return *this;
   }
-  static void PrintVolume(const pa_volume_t vol) {
-    absl::PrintF("%d\n", (vol * 100 + PA_VOLUME_NORM / 2) / PA_VOLUME_NORM);
+  ~Task() {
+    if (handle_) handle_.destroy();
   }
-  static void PrintMute(const bool mute) { absl::PrintF("%d\n", mute ? 1 : 0); }
 
  private:
-  static void DrainCB(pa_context *const ctx, void *) {
-    pa_context_disconnect(ctx);
-  }
-  pa_mainloop_api *api_;
+  explicit Task(const std::coroutine_handle<promise_type> handle)
+      : handle_{handle} {}
+
+  std::coroutine_handle<promise_type> handle_;
 };
 
-template <typename T, typename Traits>
-class GetVolumeSubcommand : public Subcommand, private Caster<T> {
+// A coroutine awaiting one or more replies, resumed by whichever comes last.
+struct Waiter {
+  std::coroutine_handle<> handle;
+  int remaining;
+};
+
+// Awaits the reply to a request. Derived classes send the request in Send(),
+// returning false if it couldn't be, and call Done() once the reply is in.
+template <typename Derived>
+class Reply {
  public:
-  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
-    if (!IsValid(T::kName, args)) return {};
-    if (!args.empty()) return {};
-    return std::unique_ptr<T>(new T());
-  }
-  static std::string Usage(absl::string_view argv0) {
-    return absl::StrCat(argv0, " ", T::kName);
+  bool await_ready() const { return false; }
+  bool await_suspend(const std::coroutine_handle<> handle) {
+    own_ = {handle, 1};
+    return Start(&own_);
   }
-  void Run(pa_context *const ctx) final {
-    WrapUniqueOperation(
-        Traits::GetInfo(ctx, Traits::kDefaultName, GetVolumeCB, this));
+  // Sends the request, for its reply to count towards waiter.
+  bool Start(Waiter *const waiter) {
+    waiter_ = waiter;
+    return static_cast<Derived *>(this)->Send();
   }
 
  protected:
-  explicit GetVolumeSubcommand() {}
+  void Done() {
+    if (--waiter_->remaining == 0) waiter_->handle.resume();
+  }
 
  private:
-  static void GetVolumeCB(pa_context *const ctx,
-                          const typename Traits::InfoT *const info,
-                          const int is_last, void *const userdata) {
-    const auto sc = T::Cast(userdata);
-    if (is_last < 0) return sc->quit(1);
-    if (is_last) return;
-    PrintVolume(pa_cvolume_avg(&info->volume));
-    Drain(ctx);
-  }
+  Waiter own_;
+  Waiter *waiter_ = nullptr;
 };
-class GetSinkVolumeSubcommand final
-    : public GetVolumeSubcommand<GetSinkVolumeSubcommand, SinkTraits> {
+
+// Sends several requests at once and awaits all their replies, which are
+// then read from the Replies themselves.
+template <typename... Replies>
+class WhenAll {
  public:
-  static inline constexpr absl::string_view kName = "get-sink-volume";
-  using GetVolumeSubcommand::GetVolumeSubcommand;
+  explicit WhenAll(Replies &...replies) : replies_{replies...} {}
+  bool await_ready() const { return false; }
+  bool await_suspend(const std::coroutine_handle<> handle) {
+    waiter_ = {handle, static_cast<int>(sizeof...(Replies))};
+    std::apply([this](auto &...reply) { (Start(reply), ...); }, replies_);
+    return waiter_.remaining > 0;
+  }
+  void await_resume() const {}
+
+ private:
+  template <typename R>
+  void Start(R &reply) {
+    if (!reply.Start(&waiter_)) waiter_.remaining--;
+  }
+
+  std::tuple<Replies &...> replies_;
+  Waiter waiter_;
 };
-class GetSourceVolumeSubcommand final
-    : public GetVolumeSubcommand<GetSourceVolumeSubcommand, SourceTraits> {
- public:
-  static inline constexpr absl::string_view kName = "get-source-volume";
-  using GetVolumeSubcommand::GetVolumeSubcommand;
+
+// What a sink's or source's info says that outlives the callback.
+struct DeviceInfo {
+  pa_cvolume volume;
+  pa_channel_map channel_map;
+  bool mute;
+  std::string name;
 };
 
-template <typename T, typename Traits>
-class SetVolumeSubcommand : public Subcommand, private Caster<T> {
+// The default device's info, or nothing if it couldn't be had.
+template <typename Traits>
+class InfoReply : public Reply<InfoReply<Traits>> {
  public:
-  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
-    if (!IsValid(T::kName, args)) return {};
-    if (args.size() != 1) return {};
-    pa_volume_t vol;
-    if (!absl::SimpleAtoi(args.front(), &vol)) return {};
-    vol = vol * PA_VOLUME_NORM / 100;
-    if (!PA_VOLUME_IS_VALID(vol)) return {};
-    return std::unique_ptr<T>(new T(vol));
-  }
-  static std::string Usage(absl::string_view argv0) {
-    return absl::StrCat(argv0, " ", T::kName, " <percentage>");
+  explicit InfoReply(pa_context *const ctx) : ctx_{ctx} {}
+  std::optional<DeviceInfo> await_resume() const { return info_; }
+  [[nodiscard]] const std::optional<DeviceInfo> &info() const { return info_; }
+
+ private:
+  friend class Reply<InfoReply>;
+
+  bool Send() {
+    return static_cast<bool>(WrapUniqueOperation(
+        Traits::GetInfo(ctx_, Traits::kDefaultName, InfoCB, this)));
   }
-  void Run(pa_context *const ctx) final {
-    WrapUniqueOperation(
-        Traits::GetInfo(ctx, Traits::kDefaultName, GetVolumeCB, this));
+  static void InfoCB(pa_context *, const typename Traits::InfoT *const info,
+                     const int is_last, void *const userdata) {
+    const auto reply = static_cast<InfoReply *>(userdata);
+    if (!is_last) {
+      Tracer::Mark("get_info");
+      reply->info_ = {info->volume, info->channel_map, !!info->mute,
+                      info->name ? info->name : ""};
+      return;
+    }
+    if (is_last < 0) reply->info_.reset();
+    reply->Done();
   }
 
+  pa_context *const ctx_;
+  std::optional<DeviceInfo> info_;
+};
+
+// Whether the default device's volume was set.
+template <typename Traits>
+class SetVolumeReply : public Reply<SetVolumeReply<Traits>> {
+ public:
+  SetVolumeReply(pa_context *const ctx, const pa_cvolume &cv)
+      : ctx_{ctx}, cv_{cv}, success_{false} {}
+  bool await_resume() const { return success_; }
+
+ private:
+  friend class Reply<SetVolumeReply>;
+
+  bool Send() {
+    return static_cast<bool>(WrapUniqueOperation(Traits::SetVolume(
+        ctx_, Traits::kDefaultName, &cv_, SuccessCB, this)));
+  }
+  static void SuccessCB(pa_context *, const int success, void *const userdata) {
+    Tracer::Mark("set_volume");
+    const auto reply = static_cast<SetVolumeReply *>(userdata);
+    reply->success_ = success;
+    reply->Done();
+  }
+
+  pa_context *const ctx_;
+  const pa_cvolume cv_;
+  bool success_;
+};
+
+// Whether the default device's mute state was set.
+template <typename Traits>
+class SetMuteReply : public Reply<SetMuteReply<Traits>> {
+ public:
+  SetMuteReply(pa_context *const ctx, const bool mute)
+      : ctx_{ctx}, mute_{mute}, success_{false} {}
+  bool await_resume() const { return success_; }
+
+ private:
+  friend class Reply<SetMuteReply>;
+
+  bool Send() {
+    return static_cast<bool>(WrapUniqueOperation(Traits::SetMute(
+        ctx_, Traits::kDefaultName, mute_, SuccessCB, this)));
+  }
+  static void SuccessCB(pa_context *, const int success, void *const userdata) {
+    Tracer::Mark("set_mute");
+    const auto reply = static_cast<SetMuteReply *>(userdata);
+    reply->success_ = success;
+    reply->Done();
+  }
+
+  pa_context *const ctx_;
+  const bool mute_;
+  bool success_;
+};
+
+// Folds bursts of subscription events into single fetches. Events for one
+// object that arrive within a window of the first, or while a fetch of it is
+// outstanding, cause just one more fetch.
+class EventCoalescer {
+ public:
+  // The event facility and index of an object.
+  using Key = std::pair<int, uint32_t>;
+  // Starts fetching an object. The owner calls Done() once that completes.
+  using FetchFn = absl::AnyInvocable<void(const Key &)>;
+  static inline constexpr pa_usec_t kDefaultWindow = 5 * PA_USEC_PER_MSEC;
+
+  explicit EventCoalescer(pa_mainloop_api *const api, const pa_usec_t window,
+                          FetchFn fetch)
+      : api_{api},
+        window_{window},
+        fetch_{std::move(fetch)},
+        events_{0},
+        fetches_{0} {}
+  EventCoalescer(const EventCoalescer &) = delete;
+  EventCoalescer &operator=(const EventCoalescer &) = delete;
+  void Notify(const Key &key) {
+    ++events_;
+    Entry &entry = entries_.try_emplace(key, this, key).first->second;
+    if (entry.fetching) {
+      entry.stale = true;
+      return;
+    }
+    Arm(entry);
+  }
+  void Done(const Key &key) {
+    const auto it = entries_.find(key);
+    if (it == entries_.end()) return;
+    Entry &entry = it->second;
+    entry.fetching = false;
+    if (!entry.stale) {
+      if (!entry.timer) entries_.erase(it);
+      return;
+    }
+    entry.stale = false;
+    Arm(entry);
+  }
+  [[nodiscard]] uint64_t events() const { return events_; }
+  [[nodiscard]] uint64_t fetches() const { return fetches_; }
+
+ private:
+  struct Entry {
+    explicit Entry(EventCoalescer *const owner, const Key &key)
+        : owner{owner},
+          key{key},
+          timer{nullptr},
+          fetching{false},
+          stale{false} {}
+    EventCoalescer *const owner;
+    const Key key;
+    pa_time_event *timer;
+    bool fetching;
+    bool stale;
+  };
+  void Arm(Entry &entry) {
+    if (entry.timer) return;
+    timeval tv;
+    pa_timeval_add(pa_gettimeofday(&tv), window_);
+    entry.timer = api_->time_new(api_, &tv, TimerCB, &entry);
+  }
+  // The fetch may call Done() and so erase the entry before returning.
+  static void TimerCB(pa_mainloop_api *const api, pa_time_event *const timer,
+                      const timeval *, void *const userdata) {
+    Entry &entry = *Caster<Entry>::Cast(userdata);
+    api->time_free(timer);
+    entry.timer = nullptr;
+    entry.fetching = true;
+    ++entry.owner->fetches_;
+    entry.owner->fetch_(entry.key);
+  }
+
+  pa_mainloop_api *const api_;
+  const pa_usec_t window_;
+  FetchFn fetch_;
+  std::map<Key, Entry> entries_;
+  uint64_t events_;
+  uint64_t fetches_;
+};
+
+class Subcommand {
+ public:
+  // Several subcommands separated by "--" run concurrently on one connection.
+  static std::unique_ptr<Subcommand> Build(
+      absl::Span<const absl::string_view> args);
+  virtual ~Subcommand() = default;
+  static std::string Usage(absl::string_view argv0);
+  virtual void Run(pa_context *) = 0;
+  // Resident subcommands keep running after their first result; everything
+  // else produces one result and can be forwarded to a daemon.
+  [[nodiscard]] virtual bool resident() const { return false; }
+  // Called when the process is about to exit on a signal.
+  virtual void Stop() {}
+  // Whether running again from the start, on a new connection, would do no
+  // more than was asked: true unless a change that isn't idempotent may
+  // already have reached the server.
+  [[nodiscard]] virtual bool retryable() const { return true; }
+  // Whether a resident subcommand carries on over a new connection, being Run
+  // again once it is ready, rather than ending with the one it ran on.
+  [[nodiscard]] virtual bool reconnects() const { return false; }
+  // Called when the connection the subcommand ran on fails, after which it
+  // must not be used.
+  virtual void Disconnected() {}
+  // Passes what must outlive this run to next, a subcommand built from the
+  // same arguments to run again in its place.
+  virtual void HandOver(Subcommand &) {}
+  // Gives a one-shot subcommand the chance to complete without connecting,
+  // by handing its work to another process, waiting on it for no longer than
+  // timeout if given. Returns the exit status if so.
+  virtual std::optional<int> Delegate(std::optional<pa_usec_t>) {
+    return std::nullopt;
+  }
+  // Lets a subcommand that needs neither the server nor a daemon do without
+  // both. Returns the exit status if so.
+  virtual std::optional<int> RunOffline() { return std::nullopt; }
+#ifdef PAKNOB_PIPEWIRE
+  // Lets a one-shot subcommand go to PipeWire directly rather than through
+  // pipewire-pulse, within the timeouts given, as for the server. Returns
+  // the exit status if so.
+  virtual std::optional<int> RunPipeWire(std::optional<pa_usec_t>,
+                                         std::optional<pa_usec_t>) {
+    return std::nullopt;
+  }
+#endif
+  void quit(int ret) { api_->quit(api_, ret); }
+  // Whether the result is in, so that running again would repeat it.
+  [[nodiscard]] bool finished() const { return finished_; }
+  [[nodiscard]] pa_mainloop_api *api() const { return api_; }
+  void set_api(pa_mainloop_api *api) {
+    assert(!api_);
+    api_ = api;
+  }
+  // Called with the exit status and output once the subcommand finishes,
+  // instead of printing the output and draining the context.
+  using DoneCallback =
+      absl::AnyInvocable<void(pa_context *, int, absl::string_view)>;
+  void set_done(DoneCallback done) { done_ = std::move(done); }
+  // Where the subcommand's Tasks keep their frames.
+  Arena &arena() { return arena_; }
+
  protected:
-  explicit SetVolumeSubcommand(const pa_volume_t vol) : vol_{vol} {}
+  Subcommand() : api_{nullptr} {}
+  static bool IsValid(absl::string_view name,
+                      absl::Span<const absl::string_view> &args) {
+    if (args.empty()) return false;
+    if (args.front() != name) return false;
+    args.remove_prefix(1);
+    return true;
+  }
+#ifdef PAKNOB_PIPEWIRE
+  // The exit status of a RunPipeWire whose call on pw failed.
+  static int Failed(const paknob::pipewire::Connection &pw) {
+    return pw.timed_out() ? paknob::kExitTimeout : EXIT_FAILURE;
+  }
+#endif
+  static void Drain(pa_context *const ctx) {
+    if (!Server::IsPending(ctx) ||
+        !WrapUniqueOperation(pa_context_drain(ctx, DrainCB, nullptr)))
+      Server::Disconnect(ctx);
+  }
+  void Finish(pa_context *const ctx, const int ret = 0) {
+    finished_ = true;
+    if (done_) return done_(ctx, ret, out_);
+    Stats::Output(out_.size());
+    fwrite(out_.data(), 1, out_.size(), stdout);
+    if (ret) return quit(ret);
+    Drain(ctx);
+  }
+  // Writes out what has been printed so far, for resident subcommands that
+  // never Finish. Returns false once nobody is reading.
+  bool Flush() {
+    Stats::Output(out_.size());
+    fwrite(out_.data(), 1, out_.size(), stdout);
+    out_.clear();
+    return fflush(stdout) == 0 && !ferror(stdout);
+  }
+  // Everything printed so far, for output that doesn't fit the helpers below.
+  std::string &out() { return out_; }
+  static int Percentage(const pa_volume_t vol) {
+    return paknob::Percentage(vol);
+  }
+  void PrintVolume(const pa_volume_t vol) {
+    absl::StrAppendFormat(&out_, "%d\n", Percentage(vol));
+  }
+  void PrintMute(const bool mute) {
+    absl::StrAppendFormat(&out_, "%d\n", mute ? 1 : 0);
+  }
+  void PrintVolumeAndMute(const pa_volume_t vol, const bool mute) {
+    absl::StrAppendFormat(&out_, "%d %d\n", Percentage(vol), mute ? 1 : 0);
+  }
+
+ private:
+  static std::unique_ptr<Subcommand> BuildOne(
+      absl::Span<const absl::string_view> args);
+  static void DrainCB(pa_context *const ctx, void *) {
+    Tracer::Mark("drain");
+    Server::Disconnect(ctx);
+  }
+  pa_mainloop_api *api_;
+  DoneCallback done_;
+  std::string out_;
+  bool finished_ = false;
+  Arena arena_;
+};
+
+template <typename T, typename Traits>
+class GetVolumeSubcommand : public Subcommand, private Caster<T> {
+ public:
+  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
+    if (!IsValid(T::kName, args)) return {};
+    if (!args.empty()) return {};
+    return std::unique_ptr<T>(new T());
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", T::kName);
+  }
+  void Run(pa_context *const ctx) final {
+    WrapUniqueOperation(
+        Traits::GetInfo(ctx, Traits::kDefaultName, GetVolumeCB, this));
+  }
+#ifdef PAKNOB_PIPEWIRE
+  std::optional<int> RunPipeWire(
+      const std::optional<pa_usec_t> connect_timeout,
+      const std::optional<pa_usec_t> timeout) final {
+    const auto pw =
+        paknob::pipewire::Connection::Open(connect_timeout, timeout);
+    if (!pw) return std::nullopt;
+    paknob::pipewire::Info info;
+    if (!pw->Get(Traits::kMetadataKey, &info)) return Failed(*pw);
+    Tracer::Mark("get_info");
+    PrintVolume(pa_cvolume_avg(&info.volume));
+    return Flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+#endif
+
+ protected:
+  explicit GetVolumeSubcommand() {}
 
  private:
   static void GetVolumeCB(pa_context *const ctx,
                           const typename Traits::InfoT *const info,
                           const int is_last, void *const userdata) {
     const auto sc = T::Cast(userdata);
-    if (is_last < 0) return sc->quit(1);
+    if (is_last < 0) return sc->Finish(ctx, 1);
     if (is_last) return;
-    pa_cvolume cv = info->volume;
-    pa_cvolume_set(&cv, info->channel_map.channels, sc->vol_);
-    WrapUniqueOperation(
-        Traits::SetVolume(ctx, Traits::kDefaultName, &cv, SetVolumeCB, sc));
+    Tracer::Mark("get_info");
+    sc->PrintVolume(pa_cvolume_avg(&info->volume));
+    sc->Finish(ctx);
   }
-  static void SetVolumeCB(pa_context *const ctx, const int success,
-                          void *const userdata) {
-    const auto sc = T::Cast(userdata);
-    if (!success) return sc->quit(1);
-    PrintVolume(sc->vol_);
-    Drain(ctx);
+};
+class GetSinkVolumeSubcommand final
+    : public GetVolumeSubcommand<GetSinkVolumeSubcommand, SinkTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "get-sink-volume";
+  using GetVolumeSubcommand::GetVolumeSubcommand;
+};
+class GetSourceVolumeSubcommand final
+    : public GetVolumeSubcommand<GetSourceVolumeSubcommand, SourceTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "get-source-volume";
+  using GetVolumeSubcommand::GetVolumeSubcommand;
+};
+
+template <typename T, typename Traits>
+class SetVolumeSubcommand : public Subcommand {
+ public:
+  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
+    if (!IsValid(T::kName, args)) return {};
+    if (args.size() != 1) return {};
+    pa_volume_t vol;
+    if (!absl::SimpleAtoi(args.front(), &vol)) return {};
+    vol = vol * PA_VOLUME_NORM / 100;
+    if (!PA_VOLUME_IS_VALID(vol)) return {};
+    return std::unique_ptr<T>(new T(vol));
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", T::kName, " <percentage>");
+  }
+  void Run(pa_context *const ctx) final { task_ = Main(ctx); }
+#ifdef PAKNOB_PIPEWIRE
+  std::optional<int> RunPipeWire(
+      const std::optional<pa_usec_t> connect_timeout,
+      const std::optional<pa_usec_t> timeout) final {
+    const auto pw =
+        paknob::pipewire::Connection::Open(connect_timeout, timeout);
+    if (!pw) return std::nullopt;
+    paknob::pipewire::Info info;
+    if (!pw->Get(Traits::kMetadataKey, &info)) return Failed(*pw);
+    Tracer::Mark("get_info");
+    paknob::Plan({paknob::Action::kSetVolume, vol_}, &info.volume, &info.mute);
+    if (!pw->SetVolume(Traits::kMetadataKey, info.volume)) return Failed(*pw);
+    Tracer::Mark("set_volume");
+    PrintVolume(vol_);
+    return Flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+#endif
+
+ protected:
+  explicit SetVolumeSubcommand(const pa_volume_t vol) : vol_{vol} {}
+
+ private:
+  Task Main(pa_context *const ctx) {
+    const auto info = co_await InfoReply<Traits>(ctx);
+    if (!info) co_return Finish(ctx, 1);
+    pa_cvolume cv = info->volume;
+    bool mute = info->mute;
+    paknob::Plan({paknob::Action::kSetVolume, vol_}, &cv, &mute);
+    if (!co_await SetVolumeReply<Traits>(ctx, cv)) co_return Finish(ctx, 1);
+    PrintVolume(vol_);
+    Finish(ctx);
   }
 
   pa_volume_t vol_;
+  Task task_;
 };
 class SetSinkVolumeSubcommand final
     : public SetVolumeSubcommand<SetSinkVolumeSubcommand, SinkTraits> {
@@ -212,6 +1739,190 @@ class SetSourceVolumeSubcommand final
   using SetVolumeSubcommand::SetVolumeSubcommand;
 };
 
+// Lets concurrent adjustments of one device merge rather than race their
+// read-modify-write cycles. The first process to find the device idle
+// applies its adjustment; the others add their deltas to a shared file for
+// it to pick up, wait for it to finish, and report the volume it left.
+//
+// Each applier's turn is a numbered round, and the file records how the last
+// rounds ended, so that a waiter learns whether its delta made it. Waiters
+// never touch the apply lock except to find, while holding the file's lock,
+// that nobody holds it any more, which means their applier died.
+class DeltaJournal {
+ public:
+  static std::unique_ptr<DeltaJournal> Open(const absl::string_view kind) {
+    const std::string path = RuntimePath(absl::StrCat("paknob-", kind));
+    if (path.empty()) return {};
+    const int state_fd = open(absl::StrCat(path, ".delta").c_str(),
+                              O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (state_fd < 0) return {};
+    const int apply_fd = open(absl::StrCat(path, ".lock").c_str(),
+                              O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (apply_fd < 0) {
+      close(state_fd);
+      return {};
+    }
+    return std::unique_ptr<DeltaJournal>(new DeltaJournal(state_fd, apply_fd));
+  }
+  // An applier that goes away without finishing fails its round.
+  ~DeltaJournal() {
+    if (applying_) Fail();
+    close(state_fd_);
+    close(apply_fd_);
+  }
+  // Returns true if this process should apply its delta itself, and
+  // otherwise adds it to what the process already doing so will pick up.
+  bool Claim(const int64_t delta) {
+    if (flock(state_fd_, LOCK_EX) != 0) return true;
+    State state = Read();
+    applying_ = flock(apply_fd_, LOCK_EX | LOCK_NB) == 0;
+    if (applying_) {
+      // Anything pending when nobody is applying was left by one that died,
+      // and its waiters are told so.
+      if (state.done < state.round) End(&state, true);
+      state.pending = 0;
+      ++state.round;
+    } else {
+      state.pending += delta;
+    }
+    round_ = state.round;
+    Write(state);
+    flock(state_fd_, LOCK_UN);
+    return applying_;
+  }
+  // For the applier: takes whatever others have added since.
+  int64_t Take() {
+    if (flock(state_fd_, LOCK_EX) != 0) return 0;
+    State state = Read();
+    const int64_t delta = state.pending;
+    state.pending = 0;
+    Write(state);
+    flock(state_fd_, LOCK_UN);
+    return delta;
+  }
+  // For the applier, once a change is done: takes whatever others have added
+  // since, or if there is nothing, records the volume it left and lets the
+  // next process apply.
+  int64_t Release(const pa_volume_t vol) {
+    if (flock(state_fd_, LOCK_EX) != 0) return 0;
+    State state = Read();
+    const int64_t delta = state.pending;
+    state.pending = 0;
+    if (!delta) {
+      state.vol = vol;
+      End(&state, false);
+    }
+    Write(state);
+    if (!delta) {
+      applying_ = false;
+      flock(apply_fd_, LOCK_UN);
+    }
+    flock(state_fd_, LOCK_UN);
+    return delta;
+  }
+  // For the applier, if a change failed: drops what others have added, tells
+  // them so, and lets the next process apply.
+  void Fail() {
+    flock(state_fd_, LOCK_EX);
+    State state = Read();
+    state.pending = 0;
+    End(&state, true);
+    Write(state);
+    applying_ = false;
+    flock(apply_fd_, LOCK_UN);
+    flock(state_fd_, LOCK_UN);
+  }
+  // For everyone else: waits for the applier to finish, for no longer than
+  // timeout if given, and returns the exit status to report. If that is
+  // success, vol is set to the volume it left.
+  int Wait(const std::optional<pa_usec_t> timeout, pa_volume_t *const vol) {
+    const pa_usec_t deadline = timeout ? pa_rtclock_now() + *timeout : 0;
+    for (pa_usec_t delay = kFirstPoll;;
+         delay = std::min(2 * delay, kMaxPoll)) {
+      if (flock(state_fd_, LOCK_SH) != 0) return EXIT_FAILURE;
+      const State state = Read();
+      const bool ended = state.done >= round_;
+      // Nobody can claim the lock while we hold the file's.
+      const bool died = !ended && flock(apply_fd_, LOCK_EX | LOCK_NB) == 0;
+      if (died) flock(apply_fd_, LOCK_UN);
+      flock(state_fd_, LOCK_UN);
+      if (ended) {
+        const uint64_t age = state.done - round_;
+        if (age >= kRounds || (state.failures >> age & 1) || !state.vol)
+          return EXIT_FAILURE;
+        *vol = *state.vol;
+        return EXIT_SUCCESS;
+      }
+      if (died) return EXIT_FAILURE;
+      if (timeout && pa_rtclock_now() + delay > deadline)
+        return paknob::kExitTimeout;
+      usleep(delay);
+    }
+  }
+
+ private:
+  // How often waiters look for their round to end.
+  static inline constexpr pa_usec_t kFirstPoll = PA_USEC_PER_MSEC;
+  static inline constexpr pa_usec_t kMaxPoll = 16 * PA_USEC_PER_MSEC;
+  // How many of the last rounds' outcomes are kept.
+  static inline constexpr uint64_t kRounds = 32;
+  // Always this long, so there is never a stale tail to truncate.
+  static inline constexpr size_t kLine = 128;
+  struct State {
+    int64_t pending = 0;
+    std::optional<pa_volume_t> vol;
+    // The last round started and the last one ended.
+    uint64_t round = 0;
+    uint64_t done = 0;
+    // Bit i is set if round done - i failed.
+    uint32_t failures = 0;
+  };
+
+  explicit DeltaJournal(const int state_fd, const int apply_fd)
+      : state_fd_{state_fd},
+        apply_fd_{apply_fd},
+        applying_{false},
+        round_{0} {}
+  // Rounds run one at a time, so the one ending is always the one after the
+  // last to have ended.
+  static void End(State *const state, const bool failed) {
+    state->failures = state->failures << 1 | failed;
+    state->done = state->round;
+  }
+  State Read() const {
+    State state;
+    char buf[kLine];
+    const ssize_t n = pread(state_fd_, buf, sizeof(buf), 0);
+    if (n <= 0) return state;
+    const std::vector<absl::string_view> fields =
+        absl::StrSplit(absl::string_view(buf, n), absl::ByAnyChar(" \n"),
+                       absl::SkipEmpty());
+    if (fields.size() != 5) return state;
+    if (!absl::SimpleAtoi(fields[0], &state.pending) ||
+        !absl::SimpleAtoi(fields[2], &state.round) ||
+        !absl::SimpleAtoi(fields[3], &state.done) ||
+        !absl::SimpleHexAtoi(fields[4], &state.failures) ||
+        state.done > state.round)
+      return State();
+    if (pa_volume_t vol; absl::SimpleAtoi(fields[1], &vol)) state.vol = vol;
+    return state;
+  }
+  void Write(const State &state) const {
+    const std::string buf = absl::StrFormat(
+        "%-*s\n", kLine - 1,
+        absl::StrFormat("%d %s %d %d %x", state.pending,
+                        state.vol ? absl::StrCat(*state.vol) : "-",
+                        state.round, state.done, state.failures));
+    pwrite(state_fd_, buf.data(), buf.size(), 0);
+  }
+
+  const int state_fd_;
+  const int apply_fd_;
+  bool applying_;
+  // The round this process applies or waits for.
+  uint64_t round_;
+};
+
 template <typename T, typename Traits, bool dec = false>
 class AdjustVolumeSubcommand : public Subcommand, private Caster<T> {
  public:
@@ -235,40 +1946,91 @@ class AdjustVolumeSubcommand : public Subcommand, private Caster<T> {
     WrapUniqueOperation(
         Traits::GetInfo(ctx, Traits::kDefaultName, GetVolumeCB, this));
   }
+  [[nodiscard]] bool retryable() const final { return !written_; }
+  // The rebuilt subcommand applies for everyone this one was applying for.
+  void HandOver(Subcommand &next) final {
+    static_cast<AdjustVolumeSubcommand &>(next).journal_ = std::move(journal_);
+  }
+  std::optional<int> Delegate(const std::optional<pa_usec_t> timeout) final {
+    journal_ = DeltaJournal::Open(Traits::kKind);
+    if (!journal_ || journal_->Claim(delta())) return std::nullopt;
+    pa_volume_t vol;
+    if (const int ret = journal_->Wait(timeout, &vol); ret != EXIT_SUCCESS)
+      return ret;
+    PrintVolume(vol);
+    return Flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+#ifdef PAKNOB_PIPEWIRE
+  // The same as Run, a write at a time, with whatever others add meanwhile.
+  std::optional<int> RunPipeWire(
+      const std::optional<pa_usec_t> connect_timeout,
+      const std::optional<pa_usec_t> timeout) final {
+    const auto pw =
+        paknob::pipewire::Connection::Open(connect_timeout, timeout);
+    if (!pw) return std::nullopt;
+    paknob::pipewire::Info info;
+    if (!pw->Get(Traits::kMetadataKey, &info)) return Failed(*pw);
+    Tracer::Mark("get_info");
+    int64_t adj = delta() + (journal_ ? journal_->Take() : 0);
+    do {
+      paknob::Plan({paknob::Action::kAdjustVolume, adj}, &info.volume,
+                   &info.mute);
+      vol_ = pa_cvolume_avg(&info.volume);
+      if (!pw->SetVolume(Traits::kMetadataKey, info.volume)) return Failed(*pw);
+      Tracer::Mark("set_volume");
+    } while (journal_ && (adj = journal_->Release(vol_)));
+    PrintVolume(vol_);
+    return Flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+#endif
 
  protected:
   explicit AdjustVolumeSubcommand(const bool neg, const pa_volume_t vol_adj)
-      : neg_{neg}, vol_adj_{vol_adj} {}
+      : neg_{neg}, vol_adj_{vol_adj}, written_{false} {}
 
  private:
+  [[nodiscard]] int64_t delta() const {
+    return neg_ ? -int64_t{vol_adj_} : int64_t{vol_adj_};
+  }
   static void GetVolumeCB(pa_context *const ctx,
                           const typename Traits::InfoT *const info,
                           const int is_last, void *const userdata) {
     const auto sc = T::Cast(userdata);
-    if (is_last < 0) return sc->quit(1);
+    if (is_last < 0) return sc->Finish(ctx, 1);
     if (is_last) return;
-    pa_cvolume cv = info->volume;
-    for (int i = 0; i < cv.channels; i++) {
-      if (sc->neg_)
-        cv.values[i] -= std::min(cv.values[i], sc->vol_adj_);
-      else
-        cv.values[i] = std::min(cv.values[i] + sc->vol_adj_, PA_VOLUME_MAX);
-    }
-    sc->vol_ = pa_cvolume_avg(&cv);
+    Tracer::Mark("get_info");
+    sc->cv_ = info->volume;
+    sc->mute_ = info->mute;
+    sc->Apply(ctx, sc->delta() + (sc->journal_ ? sc->journal_->Take() : 0));
+  }
+  void Apply(pa_context *const ctx, const int64_t delta) {
+    paknob::Plan({paknob::Action::kAdjustVolume, delta}, &cv_, &mute_);
+    vol_ = pa_cvolume_avg(&cv_);
+    written_ = true;
     WrapUniqueOperation(
-        Traits::SetVolume(ctx, Traits::kDefaultName, &cv, SetVolumeCB, sc));
+        Traits::SetVolume(ctx, Traits::kDefaultName, &cv_, SetVolumeCB, this));
   }
   static void SetVolumeCB(pa_context *const ctx, const int success,
                           void *const userdata) {
+    Tracer::Mark("set_volume");
     const auto sc = T::Cast(userdata);
-    if (!success) return sc->quit(1);
-    PrintVolume(sc->vol_);
-    Drain(ctx);
+    if (!success) return sc->Finish(ctx, 1);
+    if (sc->journal_) {
+      if (const int64_t delta = sc->journal_->Release(sc->vol_); delta)
+        return sc->Apply(ctx, delta);
+    }
+    sc->PrintVolume(sc->vol_);
+    sc->Finish(ctx);
   }
 
   bool neg_;
   pa_volume_t vol_adj_;
   pa_volume_t vol_;
+  pa_cvolume cv_;
+  bool mute_;
+  // Whether a change has been sent, so that running again could repeat it.
+  bool written_;
+  std::unique_ptr<DeltaJournal> journal_;
 };
 class IncrementSinkVolumeSubcommand final
     : public AdjustVolumeSubcommand<IncrementSinkVolumeSubcommand, SinkTraits> {
@@ -298,159 +2060,1464 @@ class DecrementSourceVolumeSubcommand final
   using AdjustVolumeSubcommand::AdjustVolumeSubcommand;
 };
 
-template <typename T, typename Traits>
-class GetMuteSubcommand : public Subcommand, private Caster<T> {
+template <typename T, typename Traits>
+class GetMuteSubcommand : public Subcommand, private Caster<T> {
+ public:
+  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
+    if (!IsValid(T::kName, args)) return {};
+    if (!args.empty()) return {};
+    return std::unique_ptr<T>(new T());
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", T::kName);
+  }
+  void Run(pa_context *const ctx) final {
+    WrapUniqueOperation(
+        Traits::GetInfo(ctx, Traits::kDefaultName, GetMuteCB, this));
+  }
+#ifdef PAKNOB_PIPEWIRE
+  std::optional<int> RunPipeWire(
+      const std::optional<pa_usec_t> connect_timeout,
+      const std::optional<pa_usec_t> timeout) final {
+    const auto pw =
+        paknob::pipewire::Connection::Open(connect_timeout, timeout);
+    if (!pw) return std::nullopt;
+    paknob::pipewire::Info info;
+    if (!pw->Get(Traits::kMetadataKey, &info)) return Failed(*pw);
+    Tracer::Mark("get_info");
+    PrintMute(info.mute);
+    return Flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+#endif
+
+ protected:
+  explicit GetMuteSubcommand() {}
+
+ private:
+  static void GetMuteCB(pa_context *const ctx,
+                        const typename Traits::InfoT *const info,
+                        const int is_last, void *const userdata) {
+    const auto sc = T::Cast(userdata);
+    if (is_last < 0) return sc->Finish(ctx, 1);
+    if (is_last) return;
+    Tracer::Mark("get_info");
+    sc->PrintMute(info->mute);
+    sc->Finish(ctx);
+  }
+};
+class GetSinkMuteSubcommand final
+    : public GetMuteSubcommand<GetSinkMuteSubcommand, SinkTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "get-sink-mute";
+  using GetMuteSubcommand::GetMuteSubcommand;
+};
+class GetSourceMuteSubcommand final
+    : public GetMuteSubcommand<GetSourceMuteSubcommand, SourceTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "get-source-mute";
+  using GetMuteSubcommand::GetMuteSubcommand;
+};
+
+template <typename T, typename Traits>
+class SetMuteSubcommand : public Subcommand, private Caster<T> {
+ public:
+  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
+    if (!IsValid(T::kName, args)) return {};
+    if (args.size() != 1) return {};
+    bool mute;
+    if (!absl::SimpleAtob(args.front(), &mute)) return {};
+    return std::unique_ptr<T>(new T(mute));
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", T::kName, " <0|1>");
+  }
+  void Run(pa_context *const ctx) final {
+    WrapUniqueOperation(
+        Traits::GetInfo(ctx, Traits::kDefaultName, GetInfoCB, this));
+  }
+#ifdef PAKNOB_PIPEWIRE
+  std::optional<int> RunPipeWire(
+      const std::optional<pa_usec_t> connect_timeout,
+      const std::optional<pa_usec_t> timeout) final {
+    const auto pw =
+        paknob::pipewire::Connection::Open(connect_timeout, timeout);
+    if (!pw) return std::nullopt;
+    paknob::pipewire::Info info;
+    if (!pw->Get(Traits::kMetadataKey, &info)) return Failed(*pw);
+    Tracer::Mark("get_info");
+    paknob::Plan({paknob::Action::kSetMute, mute_}, &info.volume, &info.mute);
+    if (!pw->SetMute(Traits::kMetadataKey, info.mute)) return Failed(*pw);
+    Tracer::Mark("set_mute");
+    PrintVolume(
+        paknob::Printed(paknob::Action::kSetMute, info.volume, info.mute));
+    return Flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+#endif
+
+ protected:
+  explicit SetMuteSubcommand(const bool mute) : mute_{mute} {}
+
+ private:
+  static void GetInfoCB(pa_context *const ctx,
+                        const typename Traits::InfoT *const info,
+                        const int is_last, void *const userdata) {
+    const auto sc = T::Cast(userdata);
+    if (is_last < 0) return sc->Finish(ctx, 1);
+    if (is_last) return;
+    Tracer::Mark("get_info");
+    pa_cvolume cv = info->volume;
+    bool mute = info->mute;
+    paknob::Plan({paknob::Action::kSetMute, sc->mute_}, &cv, &mute);
+    sc->vol_ = paknob::Printed(paknob::Action::kSetMute, cv, mute);
+    WrapUniqueOperation(
+        Traits::SetMute(ctx, Traits::kDefaultName, mute, SetMuteCB, sc));
+  }
+  static void SetMuteCB(pa_context *const ctx, const int success,
+                        void *const userdata) {
+    Tracer::Mark("set_mute");
+    const auto sc = T::Cast(userdata);
+    if (!success) return sc->Finish(ctx, 1);
+    sc->PrintVolume(sc->vol_);
+    sc->Finish(ctx);
+  }
+
+  bool mute_;
+  pa_volume_t vol_;
+};
+class SetSinkMuteSubcommand final
+    : public SetMuteSubcommand<SetSinkMuteSubcommand, SinkTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "set-sink-mute";
+  using SetMuteSubcommand::SetMuteSubcommand;
+};
+class SetSourceMuteSubcommand final
+    : public SetMuteSubcommand<SetSourceMuteSubcommand, SourceTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "set-source-mute";
+  using SetMuteSubcommand::SetMuteSubcommand;
+};
+
+template <typename T, typename Traits>
+class ToggleMuteSubcommand : public Subcommand, private Caster<T> {
+ public:
+  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
+    if (!IsValid(T::kName, args)) return {};
+    if (!args.empty()) return {};
+    return std::unique_ptr<T>(new T());
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", T::kName);
+  }
+  void Run(pa_context *const ctx) final {
+    WrapUniqueOperation(
+        Traits::GetInfo(ctx, Traits::kDefaultName, GetInfoCB, this));
+  }
+  [[nodiscard]] bool retryable() const final { return !written_; }
+#ifdef PAKNOB_PIPEWIRE
+  std::optional<int> RunPipeWire(
+      const std::optional<pa_usec_t> connect_timeout,
+      const std::optional<pa_usec_t> timeout) final {
+    const auto pw =
+        paknob::pipewire::Connection::Open(connect_timeout, timeout);
+    if (!pw) return std::nullopt;
+    paknob::pipewire::Info info;
+    if (!pw->Get(Traits::kMetadataKey, &info)) return Failed(*pw);
+    Tracer::Mark("get_info");
+    paknob::Plan({paknob::Action::kToggleMute}, &info.volume, &info.mute);
+    if (!pw->SetMute(Traits::kMetadataKey, info.mute)) return Failed(*pw);
+    Tracer::Mark("set_mute");
+    PrintVolume(
+        paknob::Printed(paknob::Action::kToggleMute, info.volume, info.mute));
+    return Flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+#endif
+
+ protected:
+  explicit ToggleMuteSubcommand() : written_{false} {}
+
+ private:
+  static void GetInfoCB(pa_context *const ctx,
+                        const typename Traits::InfoT *const info,
+                        const int is_last, void *const userdata) {
+    const auto sc = T::Cast(userdata);
+    if (is_last < 0) return sc->Finish(ctx, 1);
+    if (is_last) return;
+    Tracer::Mark("get_info");
+    pa_cvolume cv = info->volume;
+    bool mute = info->mute;
+    paknob::Plan({paknob::Action::kToggleMute}, &cv, &mute);
+    sc->vol_ = paknob::Printed(paknob::Action::kToggleMute, cv, mute);
+    sc->written_ = true;
+    WrapUniqueOperation(
+        Traits::SetMute(ctx, Traits::kDefaultName, mute, SetMuteCB, sc));
+  }
+  static void SetMuteCB(pa_context *const ctx, const int success,
+                        void *const userdata) {
+    Tracer::Mark("set_mute");
+    const auto sc = T::Cast(userdata);
+    if (!success) return sc->Finish(ctx, 1);
+    sc->PrintVolume(sc->vol_);
+    sc->Finish(ctx);
+  }
+
+  pa_volume_t vol_;
+  // Whether the toggle has been sent, so that running again could undo it.
+  bool written_;
+};
+class ToggleSinkMuteSubcommand final
+    : public ToggleMuteSubcommand<ToggleSinkMuteSubcommand, SinkTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "toggle-sink-mute";
+  using ToggleMuteSubcommand::ToggleMuteSubcommand;
+};
+class ToggleSourceMuteSubcommand final
+    : public ToggleMuteSubcommand<ToggleSourceMuteSubcommand, SourceTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "toggle-source-mute";
+  using ToggleMuteSubcommand::ToggleMuteSubcommand;
+};
+
+// One device as status, peek and hub print it: a percentage and 0 or 1, or
+// both -1 if there is no such device.
+struct DeviceStatus {
+  int volume;
+  int mute;
+  absl::string_view name;
+};
+// What status, peek and hub print when not given a format.
+inline constexpr absl::string_view kDefaultStatusFormat =
+    "{sink-volume} {sink-mute} {source-volume} {source-mute}";
+// Fills in a status format's placeholders, ending the line.
+std::string FormatStatus(const absl::string_view format,
+                         const DeviceStatus &sink,
+                         const DeviceStatus &source) {
+  return absl::StrCat(
+      absl::StrReplaceAll(format,
+                          {{"{sink-volume}", absl::StrCat(sink.volume)},
+                           {"{sink-mute}", absl::StrCat(sink.mute)},
+                           {"{sink-name}", sink.name},
+                           {"{source-volume}", absl::StrCat(source.volume)},
+                           {"{source-mute}", absl::StrCat(source.mute)},
+                           {"{source-name}", source.name}}),
+      "\n");
+}
+
+class StatusSubcommand final : public Subcommand {
+ public:
+  static inline constexpr absl::string_view kName = "status";
+  static std::unique_ptr<StatusSubcommand> Build(
+      absl::Span<const absl::string_view> args) {
+    if (!IsValid(kName, args)) return {};
+    if (args.size() > 1) return {};
+    return std::unique_ptr<StatusSubcommand>(
+        new StatusSubcommand(args.empty() ? kDefaultStatusFormat
+                                          : args.front()));
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", kName, " [<format>]");
+  }
+  void Run(pa_context *const ctx) final { task_ = Main(ctx); }
+
+ private:
+  explicit StatusSubcommand(const absl::string_view format)
+      : format_{format} {}
+  // Both requests go out at once, and the result is formatted once both
+  // replies are in. A request that can't be sent leaves its reply without
+  // info, as a failed one does, rather than being waited for.
+  Task Main(pa_context *const ctx) {
+    InfoReply<SinkTraits> sink(ctx);
+    InfoReply<SourceTraits> source(ctx);
+    co_await WhenAll(sink, source);
+    if (!sink.info() || !source.info()) co_return Finish(ctx, 1);
+    absl::StrAppend(&out(), FormatStatus(format_, Convert(*sink.info()),
+                                         Convert(*source.info())));
+    Finish(ctx);
+  }
+  static DeviceStatus Convert(const DeviceInfo &info) {
+    return {Percentage(pa_cvolume_avg(&info.volume)), info.mute, info.name};
+  }
+
+  const std::string format_;
+  Task task_;
+};
+
+template <typename T, typename Traits>
+class FollowSubcommand : public Subcommand, private Caster<T> {
+ public:
+  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
+    if (!IsValid(T::kName, args)) return {};
+    if (!args.empty()) return {};
+    return std::unique_ptr<T>(new T());
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", T::kName);
+  }
+  [[nodiscard]] bool resident() const final { return true; }
+  void Run(pa_context *const ctx) final {
+    coalescer_.emplace(api(), EventCoalescer::kDefaultWindow,
+                       [this, ctx](const EventCoalescer::Key &) {
+                         Fetch(ctx);
+                       });
+    Server::SetSubscribeCallback(ctx, SubscribeCB, this);
+    WrapUniqueOperation(Server::Subscribe(
+        ctx,
+        static_cast<pa_subscription_mask_t>(Traits::kSubscriptionMask |
+                                            PA_SUBSCRIPTION_MASK_SERVER),
+        nullptr, nullptr));
+    coalescer_->Notify(kKey);
+  }
+
+ protected:
+  explicit FollowSubcommand()
+      : index_{PA_INVALID_INDEX},
+        printed_{false},
+        vol_{PA_VOLUME_MUTED},
+        mute_{false} {}
+
+ private:
+  // Everything we follow is one object as far as coalescing goes.
+  static inline constexpr EventCoalescer::Key kKey = {Traits::kFacility,
+                                                      PA_INVALID_INDEX};
+  // Server events may mean a new default device; device events only matter
+  // for the one we are following.
+  static void SubscribeCB(pa_context *, const pa_subscription_event_type_t type,
+                          const uint32_t idx, void *const userdata) {
+    Tracer::Mark("event");
+    const auto sc = T::Cast(userdata);
+    const auto facility = type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+    if (facility == Traits::kFacility && sc->index_ != PA_INVALID_INDEX &&
+        idx != sc->index_)
+      return;
+    sc->coalescer_->Notify(kKey);
+  }
+  // A request that can't be sent is a failed fetch, and nothing would ever
+  // complete it, so we give up rather than wait.
+  void Fetch(pa_context *const ctx) {
+    if (WrapUniqueOperation(
+            Traits::GetInfo(ctx, Traits::kDefaultName, GetInfoCB, this)))
+      return;
+    coalescer_->Done(kKey);
+    Finish(ctx, 1);
+  }
+  static void GetInfoCB(pa_context *, const typename Traits::InfoT *const info,
+                        const int is_last, void *const userdata) {
+    const auto sc = T::Cast(userdata);
+    if (!is_last) {
+      Tracer::Mark("get_info");
+      return sc->Update(info);
+    }
+    if (is_last < 0) sc->index_ = PA_INVALID_INDEX;
+    sc->coalescer_->Done(kKey);
+  }
+  void Update(const typename Traits::InfoT *const info) {
+    index_ = info->index;
+    const pa_volume_t vol = pa_cvolume_avg(&info->volume);
+    const bool mute = info->mute;
+    if (printed_ && Percentage(vol) == Percentage(vol_) && mute == mute_)
+      return;
+    printed_ = true;
+    vol_ = vol;
+    mute_ = mute;
+    PrintVolumeAndMute(vol_, mute_);
+    if (!Flush()) quit(1);
+  }
+
+  std::optional<EventCoalescer> coalescer_;
+  uint32_t index_;
+  bool printed_;
+  pa_volume_t vol_;
+  bool mute_;
+};
+class FollowSinkSubcommand final
+    : public FollowSubcommand<FollowSinkSubcommand, SinkTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "follow-sink";
+  using FollowSubcommand::FollowSubcommand;
+};
+class FollowSourceSubcommand final
+    : public FollowSubcommand<FollowSourceSubcommand, SourceTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "follow-source";
+  using FollowSubcommand::FollowSubcommand;
+};
+
+// Follows the default sink and source, for resident subcommands that pass
+// their state on elsewhere. Changed() runs whenever either's volume, mute
+// state or name does, or either comes or goes.
+class DefaultsSubcommand : public Subcommand,
+                           private Caster<DefaultsSubcommand> {
+ public:
+  [[nodiscard]] bool resident() const final { return true; }
+  void Run(pa_context *const ctx) override {
+    ctx_ = ctx;
+    coalescer_.emplace(api(), EventCoalescer::kDefaultWindow,
+                       [this](const EventCoalescer::Key &key) {
+                         if (key == kKey<SinkTraits>)
+                           Fetch<SinkTraits>();
+                         else
+                           Fetch<SourceTraits>();
+                       });
+    Server::SetSubscribeCallback(ctx, SubscribeCB, this);
+    WrapUniqueOperation(Server::Subscribe(
+        ctx,
+        static_cast<pa_subscription_mask_t>(PA_SUBSCRIPTION_MASK_SINK |
+                                            PA_SUBSCRIPTION_MASK_SOURCE |
+                                            PA_SUBSCRIPTION_MASK_SERVER),
+        nullptr, nullptr));
+    coalescer_->Notify(kKey<SinkTraits>);
+    coalescer_->Notify(kKey<SourceTraits>);
+  }
+
+ protected:
+  struct Device {
+    bool present = false;
+    uint32_t index = PA_INVALID_INDEX;
+    int volume = 0;
+    bool mute = false;
+    std::string name;
+  };
+
+  explicit DefaultsSubcommand() : ctx_{nullptr} {}
+  virtual void Changed() = 0;
+  [[nodiscard]] const Device &sink() const { return sink_; }
+  [[nodiscard]] const Device &source() const { return source_; }
+
+ private:
+  template <typename Traits>
+  static inline constexpr EventCoalescer::Key kKey = {Traits::kFacility,
+                                                      PA_INVALID_INDEX};
+
+  template <typename Traits>
+  Device &device() {
+    if constexpr (std::is_same_v<Traits, SinkTraits>)
+      return sink_;
+    else
+      return source_;
+  }
+  // Server events may mean a new default device; device events only matter
+  // for the default one, if there is one.
+  static void SubscribeCB(pa_context *, const pa_subscription_event_type_t type,
+                          const uint32_t idx, void *const userdata) {
+    Tracer::Mark("event");
+    const auto sc = Cast(userdata);
+    switch (type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+      case PA_SUBSCRIPTION_EVENT_SINK:
+        return sc->Notify<SinkTraits>(idx);
+      case PA_SUBSCRIPTION_EVENT_SOURCE:
+        return sc->Notify<SourceTraits>(idx);
+      default:
+        sc->coalescer_->Notify(kKey<SinkTraits>);
+        sc->coalescer_->Notify(kKey<SourceTraits>);
+    }
+  }
+  template <typename Traits>
+  void Notify(const uint32_t idx) {
+    const Device &d = device<Traits>();
+    if (d.present && idx != d.index) return;
+    coalescer_->Notify(kKey<Traits>);
+  }
+  template <typename Traits>
+  void Fetch() {
+    if (!WrapUniqueOperation(Traits::GetInfo(ctx_, Traits::kDefaultName,
+                                             InfoCB<Traits>, this)))
+      coalescer_->Done(kKey<Traits>);
+  }
+  template <typename Traits>
+  static void InfoCB(pa_context *, const typename Traits::InfoT *const info,
+                     const int is_last, void *const userdata) {
+    const auto sc = Cast(userdata);
+    if (!is_last) {
+      Tracer::Mark("get_info");
+      return sc->Update(&sc->device<Traits>(),
+                        {true, info->index,
+                         Percentage(pa_cvolume_avg(&info->volume)),
+                         !!info->mute, info->name ? info->name : ""});
+    }
+    if (is_last < 0) sc->Update(&sc->device<Traits>(), {});
+    sc->coalescer_->Done(kKey<Traits>);
+  }
+  void Update(Device *const d, Device now) {
+    const bool changed = now.present != d->present ||
+                         now.volume != d->volume || now.mute != d->mute ||
+                         now.name != d->name;
+    *d = std::move(now);
+    if (changed) Changed();
+  }
+
+  pa_context *ctx_;
+  std::optional<EventCoalescer> coalescer_;
+  Device sink_;
+  Device source_;
+};
+
+// Keeps the default devices' state in a shared file that readers map; see
+// state.h.
+class PublishSubcommand final : public DefaultsSubcommand {
+ public:
+  static inline constexpr absl::string_view kName = "publish";
+  static std::unique_ptr<PublishSubcommand> Build(
+      absl::Span<const absl::string_view> args) {
+    if (!IsValid(kName, args)) return {};
+    if (!args.empty()) return {};
+    return std::unique_ptr<PublishSubcommand>(new PublishSubcommand());
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", kName);
+  }
+  ~PublishSubcommand() final {
+    Invalidate();
+    if (state_) munmap(state_, sizeof(*state_));
+    if (fd_ >= 0) close(fd_);
+  }
+  // The file is reused rather than replaced, so that readers that mapped it
+  // under an earlier publisher see this one's updates too. The lock keeps
+  // out a second publisher, and tells readers that this one is alive.
+  void Run(pa_context *const ctx) final {
+    const std::string path = RuntimePath(PAKNOB_STATE_FILE);
+    if (path.empty()) return quit(1);
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct flock lock = {};
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    if (fd_ < 0 || fcntl(fd_, F_OFD_SETLK, &lock) != 0 ||
+        ftruncate(fd_, sizeof(*state_)) != 0)
+      return quit(1);
+    void *const p = mmap(nullptr, sizeof(*state_), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) return quit(1);
+    state_ = static_cast<paknob_state *>(p);
+    Changed();
+    DefaultsSubcommand::Run(ctx);
+  }
+  void Stop() final { Invalidate(); }
+
+ private:
+  explicit PublishSubcommand() : fd_{-1}, state_{nullptr} {}
+  // Readers shouldn't mistake the last state for a current one, however we
+  // come to exit: on a signal, or on losing the connection.
+  void Invalidate() {
+    if (!state_) return;
+    const paknob_device none = Convert({});
+    paknob_state_publish(state_, &none, &none);
+  }
+  static paknob_device Convert(const Device &d) {
+    paknob_device out = {-1, -1, {}};
+    if (!d.present) return out;
+    out.volume = d.volume;
+    out.mute = d.mute;
+    d.name.copy(out.name, sizeof(out.name) - 1);
+    return out;
+  }
+  void Changed() final {
+    const paknob_device sink = Convert(this->sink());
+    const paknob_device source = Convert(this->source());
+    paknob_state_publish(state_, &sink, &source);
+  }
+
+  int fd_;
+  paknob_state *state_;
+};
+
+// Reads what `paknob publish` last published, without connecting to anything.
+class PeekSubcommand final : public Subcommand {
+ public:
+  static inline constexpr absl::string_view kName = "peek";
+  static std::unique_ptr<PeekSubcommand> Build(
+      absl::Span<const absl::string_view> args) {
+    if (!IsValid(kName, args)) return {};
+    if (args.size() > 1) return {};
+    return std::unique_ptr<PeekSubcommand>(
+        new PeekSubcommand(args.empty() ? kDefaultStatusFormat : args.front()));
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", kName, " [<format>]");
+  }
+  void Run(pa_context *const ctx) final { Finish(ctx, Peek()); }
+  std::optional<int> RunOffline() final {
+    const int ret = Peek();
+    return Flush() ? ret : EXIT_FAILURE;
+  }
+
+ private:
+  explicit PeekSubcommand(const absl::string_view format) : format_{format} {}
+  int Peek() {
+    const paknob_state *const state = paknob_state_map();
+    if (!state) return EXIT_FAILURE;
+    paknob_device sink, source;
+    const int read = paknob_state_read(state, &sink, &source, nullptr);
+    munmap(const_cast<paknob_state *>(state), sizeof(*state));
+    if (read != 0) return EXIT_FAILURE;
+    absl::StrAppend(&out(),
+                    FormatStatus(format_, {sink.volume, sink.mute, sink.name},
+                                 {source.volume, source.mute, source.name}));
+    return EXIT_SUCCESS;
+  }
+
+  const std::string format_;
+};
+
+// Applies a stream of volume deltas, in percentage points, and mute toggles
+// to the default device, one change at a time. Whatever arrives while a
+// change is in flight is summed into the next one, so a fast stream costs
+// no more round trips than the server can take. Derived classes open their
+// input in Open(), feed it through Add() and Toggle(), call Apply() after
+// each batch and Closed() at the end, and print each change's result in
+// Print().
+template <typename T, typename Traits>
+class DeltaSubcommand : public Subcommand, protected Caster<T> {
+ public:
+  [[nodiscard]] bool resident() const final { return true; }
+  void Run(pa_context *const ctx) final {
+    ctx_ = ctx;
+    if (!static_cast<T *>(this)->Open()) Finish(ctx, 1);
+  }
+
+ protected:
+  explicit DeltaSubcommand()
+      : ctx_{nullptr},
+        open_{true},
+        pending_{0},
+        toggle_{false},
+        busy_{false} {}
+  void Add(const int64_t delta) { pending_ += delta; }
+  // Two toggles before the first is applied cancel out.
+  void Toggle() { toggle_ = !toggle_; }
+  // Starts applying everything pending, unless a change is already in
+  // flight, in which case its completion will pick up the rest.
+  void Apply() {
+    if (busy_ || (!pending_ && !toggle_)) return;
+    busy_ = true;
+    WrapUniqueOperation(
+        Traits::GetInfo(ctx_, Traits::kDefaultName, GetInfoCB, this));
+  }
+  // There is no more input; what is pending is still applied.
+  void Closed(const bool failed) {
+    open_ = false;
+    if (!busy_) Finish(ctx_, failed ? 1 : 0);
+  }
+
+ private:
+  // A pending toggle goes first, and the volume change after it.
+  static void GetInfoCB(pa_context *const ctx,
+                        const typename Traits::InfoT *const info,
+                        const int is_last, void *const userdata) {
+    const auto sc = T::Cast(userdata);
+    if (is_last < 0) return sc->Finish(ctx, 1);
+    if (is_last) return;
+    Tracer::Mark("get_info");
+    pa_cvolume cv = info->volume;
+    sc->mute_ = info->mute;
+    if (sc->toggle_) {
+      sc->toggle_ = false;
+      paknob::Plan({paknob::Action::kToggleMute}, &cv, &sc->mute_);
+      sc->vol_ = pa_cvolume_avg(&cv);
+      WrapUniqueOperation(Traits::SetMute(ctx, Traits::kDefaultName,
+                                          sc->mute_, SetMuteCB, sc));
+      return;
+    }
+    paknob::Plan({paknob::Action::kAdjustVolume,
+                  sc->pending_ * PA_VOLUME_NORM / 100},
+                 &cv, &sc->mute_);
+    sc->pending_ = 0;
+    sc->vol_ = pa_cvolume_avg(&cv);
+    WrapUniqueOperation(
+        Traits::SetVolume(ctx, Traits::kDefaultName, &cv, SetVolumeCB, sc));
+  }
+  static void SetVolumeCB(pa_context *const ctx, const int success,
+                          void *const userdata) {
+    Tracer::Mark("set_volume");
+    T::Cast(userdata)->Applied(ctx, success);
+  }
+  static void SetMuteCB(pa_context *const ctx, const int success,
+                        void *const userdata) {
+    Tracer::Mark("set_mute");
+    T::Cast(userdata)->Applied(ctx, success);
+  }
+  void Applied(pa_context *const ctx, const int success) {
+    if (!success) return Finish(ctx, 1);
+    busy_ = false;
+    static_cast<T *>(this)->Print(vol_, mute_);
+    if (!Flush()) return quit(1);
+    if (!open_ && !pending_ && !toggle_) return Finish(ctx);
+    Apply();
+  }
+
+  pa_context *ctx_;
+  // Whether more input may come.
+  bool open_;
+  int64_t pending_;
+  bool toggle_;
+  bool busy_;
+  // What the change in flight will leave.
+  pa_volume_t vol_;
+  bool mute_;
+};
+
+// Reads percentage deltas, one per line, from stdin.
+template <typename T, typename Traits>
+class KnobSubcommand : public DeltaSubcommand<T, Traits> {
+ public:
+  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
+    if (!Subcommand::IsValid(T::kName, args)) return {};
+    if (!args.empty()) return {};
+    return std::unique_ptr<T>(new T());
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", T::kName);
+  }
+
+ protected:
+  explicit KnobSubcommand() : input_{nullptr} {}
+
+ private:
+  friend class DeltaSubcommand<T, Traits>;
+
+  bool Open() {
+    input_ = this->api()->io_new(this->api(), STDIN_FILENO, PA_IO_EVENT_INPUT,
+                                 ReadCB, this);
+    return input_;
+  }
+  void Print(const pa_volume_t vol, bool) { this->PrintVolume(vol); }
+  static void ReadCB(pa_mainloop_api *const api, pa_io_event *, const int fd,
+                     pa_io_event_flags_t, void *const userdata) {
+    Tracer::Mark("input");
+    const auto sc = T::Cast(userdata);
+    char buf[512];
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+    if (n > 0) {
+      sc->line_.append(buf, n);
+      for (size_t end; (end = sc->line_.find('\n')) != sc->line_.npos;) {
+        int delta;
+        if (absl::SimpleAtoi(absl::string_view(sc->line_).substr(0, end),
+                             &delta))
+          sc->Add(delta);
+        sc->line_.erase(0, end + 1);
+      }
+      return sc->Apply();
+    }
+    api->io_free(sc->input_);
+    sc->input_ = nullptr;
+    sc->Closed(n < 0);
+  }
+
+  pa_io_event *input_;
+  std::string line_;
+};
+class KnobSinkSubcommand final
+    : public KnobSubcommand<KnobSinkSubcommand, SinkTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "knob-sink";
+  using KnobSubcommand::KnobSubcommand;
+};
+class KnobSourceSubcommand final
+    : public KnobSubcommand<KnobSourceSubcommand, SourceTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "knob-source";
+  using KnobSubcommand::KnobSubcommand;
+};
+
+// Reads a volume knob's events device directly, so that each detent costs
+// neither a compositor keybinding nor a process. REL_DIAL and REL_WHEEL
+// detents and volume keys adjust the volume, and the mute key toggles the
+// mute state.
+template <typename T, typename Traits>
+class EvdevSubcommand : public DeltaSubcommand<T, Traits> {
+ public:
+  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
+    if (!Subcommand::IsValid(T::kName, args)) return {};
+    bool grab = false;
+    if (!args.empty() && args.front() == "--grab") {
+      grab = true;
+      args.remove_prefix(1);
+    }
+    if (args.size() != 1) return {};
+    return std::unique_ptr<T>(new T(std::string(args.front()), grab));
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", T::kName, " [--grab] <device>");
+  }
+  ~EvdevSubcommand() override {
+    if (fd_ >= 0) close(fd_);
+  }
+
+ protected:
+  EvdevSubcommand(std::string path, const bool grab)
+      : path_{std::move(path)},
+        grab_{grab},
+        fd_{-1},
+        input_{nullptr},
+        last_turn_{0},
+        last_neg_{false} {}
+
+ private:
+  friend class DeltaSubcommand<T, Traits>;
+
+  // A detent moves the volume by one percentage point, or by more when it
+  // follows one in the same direction within kAccelerationWindow: by the
+  // number of times the gap fits in the window, up to kMaxAcceleration. A
+  // slow turn still moves by single points while a spin crosses the range.
+  static inline constexpr int64_t kAccelerationWindow = 100 * PA_USEC_PER_MSEC;
+  static inline constexpr int64_t kMaxAcceleration = 5;
+
+  bool Open() {
+    fd_ = open(path_.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd_ < 0) {
+      absl::FPrintF(stderr, "%s: %s\n", path_, strerror(errno));
+      return false;
+    }
+    // Timestamps that never go backwards, for the acceleration. Older
+    // kernels keep CLOCK_REALTIME, which is good enough.
+    const int clock = CLOCK_MONOTONIC;
+    ioctl(fd_, EVIOCSCLOCKID, &clock);
+    // Keeps the compositor from also acting on the knob's keys.
+    if (grab_ && ioctl(fd_, EVIOCGRAB, 1) < 0) {
+      absl::FPrintF(stderr, "%s: %s\n", path_, strerror(errno));
+      return false;
+    }
+    input_ =
+        this->api()->io_new(this->api(), fd_, PA_IO_EVENT_INPUT, ReadCB, this);
+    return input_;
+  }
+  // Prints the state each change left, as follow-* does.
+  void Print(const pa_volume_t vol, const bool mute) {
+    this->PrintVolumeAndMute(vol, mute);
+  }
+  static void ReadCB(pa_mainloop_api *const api, pa_io_event *, const int fd,
+                     pa_io_event_flags_t, void *const userdata) {
+    Tracer::Mark("input");
+    const auto sc = T::Cast(userdata);
+    input_event events[64];
+    const ssize_t n = read(fd, events, sizeof(events));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+    if (n > 0) {
+      for (size_t i = 0; i < n / sizeof(*events); i++) sc->Handle(events[i]);
+      return sc->Apply();
+    }
+    // Unplugging the device fails the read with ENODEV.
+    api->io_free(sc->input_);
+    sc->input_ = nullptr;
+    sc->Closed(n < 0);
+  }
+  void Handle(const input_event &ev) {
+    if (ev.type == EV_REL && (ev.code == REL_DIAL || ev.code == REL_WHEEL))
+      return Turn(ev, ev.value);
+    // Presses and autorepeats, but not releases.
+    if (ev.type != EV_KEY || ev.value == 0) return;
+    switch (ev.code) {
+      case KEY_VOLUMEUP:
+        return Turn(ev, 1);
+      case KEY_VOLUMEDOWN:
+        return Turn(ev, -1);
+      case KEY_MUTE:
+        if (ev.value == 1) this->Toggle();
+        return;
+    }
+  }
+  void Turn(const input_event &ev, const int detents) {
+    if (!detents) return;
+    const int64_t now = int64_t{ev.input_event_sec} * PA_USEC_PER_SEC +
+                        ev.input_event_usec;
+    const bool neg = detents < 0;
+    const int64_t gap = std::max<int64_t>(now - last_turn_, 1);
+    int64_t factor = 1;
+    if (last_turn_ && neg == last_neg_ && gap < kAccelerationWindow)
+      factor = std::min(kMaxAcceleration, kAccelerationWindow / gap);
+    last_turn_ = now;
+    last_neg_ = neg;
+    this->Add(detents * factor);
+  }
+
+  const std::string path_;
+  const bool grab_;
+  int fd_;
+  pa_io_event *input_;
+  // When the last detent was turned, in microseconds, and which way.
+  int64_t last_turn_;
+  bool last_neg_;
+};
+class EvdevSinkSubcommand final
+    : public EvdevSubcommand<EvdevSinkSubcommand, SinkTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "evdev-sink";
+  using EvdevSubcommand::EvdevSubcommand;
+};
+class EvdevSourceSubcommand final
+    : public EvdevSubcommand<EvdevSourceSubcommand, SourceTraits> {
+ public:
+  static inline constexpr absl::string_view kName = "evdev-source";
+  using EvdevSubcommand::EvdevSubcommand;
+};
+
+class WatchEventsSubcommand final : public Subcommand,
+                                    private Caster<WatchEventsSubcommand> {
+ public:
+  static inline constexpr absl::string_view kName = "watch-events";
+  static std::unique_ptr<WatchEventsSubcommand> Build(
+      absl::Span<const absl::string_view> args) {
+    if (!IsValid(kName, args)) return {};
+    if (args.size() > 1) return {};
+    pa_usec_t window = EventCoalescer::kDefaultWindow;
+    if (!args.empty()) {
+      if (!absl::SimpleAtoi(args.front(), &window)) return {};
+      window *= PA_USEC_PER_MSEC;
+    }
+    return std::unique_ptr<WatchEventsSubcommand>(
+        new WatchEventsSubcommand(window));
+  }
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " ", kName, " [<window-ms>]");
+  }
+  [[nodiscard]] bool resident() const final { return true; }
+  void Run(pa_context *const ctx) final {
+    coalescer_.emplace(
+        api(), window_,
+        [this, ctx](const EventCoalescer::Key &key) { Fetch(ctx, key); });
+    Server::SetSubscribeCallback(ctx, SubscribeCB, this);
+    WrapUniqueOperation(Server::Subscribe(
+        ctx,
+        static_cast<pa_subscription_mask_t>(PA_SUBSCRIPTION_MASK_SINK |
+                                            PA_SUBSCRIPTION_MASK_SOURCE |
+                                            PA_SUBSCRIPTION_MASK_SERVER),
+        nullptr, nullptr));
+  }
+  void Stop() final {
+    if (!coalescer_) return;
+    absl::FPrintF(stderr, "%d events, %d fetches\n", coalescer_->events(),
+                  coalescer_->fetches());
+  }
+
+ private:
+  // Outlives the fetch of one object, so its callback knows which it was
+  // even if the object is gone.
+  struct Request {
+    WatchEventsSubcommand *const sc;
+    const EventCoalescer::Key key;
+  };
+
+  explicit WatchEventsSubcommand(const pa_usec_t window) : window_{window} {}
+  static absl::string_view FacilityName(const int facility) {
+    switch (facility) {
+      case PA_SUBSCRIPTION_EVENT_SINK:
+        return "sink";
+      case PA_SUBSCRIPTION_EVENT_SOURCE:
+        return "source";
+      case PA_SUBSCRIPTION_EVENT_SERVER:
+        return "server";
+      default:
+        return "unknown";
+    }
+  }
+  static void SubscribeCB(pa_context *, const pa_subscription_event_type_t type,
+                          const uint32_t idx, void *const userdata) {
+    Tracer::Mark("event");
+    Cast(userdata)->coalescer_->Notify(
+        {type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK, idx});
+  }
+  void Fetch(pa_context *const ctx, const EventCoalescer::Key &key) {
+    auto req = std::make_unique<Request>(Request{this, key});
+    pa_operation *op = nullptr;
+    switch (key.first) {
+      case PA_SUBSCRIPTION_EVENT_SINK:
+        op = Server::Get<pa_context_get_sink_info_by_index>(
+            ctx, key.second, InfoCB<pa_sink_info>, req.get());
+        break;
+      case PA_SUBSCRIPTION_EVENT_SOURCE:
+        op = Server::Get<pa_context_get_source_info_by_index>(
+            ctx, key.second, InfoCB<pa_source_info>, req.get());
+        break;
+      case PA_SUBSCRIPTION_EVENT_SERVER:
+        op = Server::GetServerInfo(ctx, ServerInfoCB, req.get());
+        break;
+    }
+    if (!WrapUniqueOperation(op)) return coalescer_->Done(key);
+    req.release();
+  }
+  template <typename InfoT>
+  static void InfoCB(pa_context *, const InfoT *const info, const int is_last,
+                     void *const userdata) {
+    const auto req = Caster<Request>::Cast(userdata);
+    const auto sc = req->sc;
+    const absl::string_view facility = FacilityName(req->key.first);
+    if (!is_last) {
+      Tracer::Mark("get_info");
+      absl::StrAppendFormat(&sc->out(), "%s %d %s %d %d\n", facility,
+                            info->index, info->name,
+                            Percentage(pa_cvolume_avg(&info->volume)),
+                            info->mute ? 1 : 0);
+      return;
+    }
+    if (is_last < 0)
+      absl::StrAppendFormat(&sc->out(), "%s %d removed\n", facility,
+                            req->key.second);
+    sc->Complete(std::unique_ptr<Request>(req));
+  }
+  static void ServerInfoCB(pa_context *, const pa_server_info *const info,
+                           void *const userdata) {
+    const auto req = Caster<Request>::Cast(userdata);
+    const auto sc = req->sc;
+    Tracer::Mark("get_server_info");
+    if (info)
+      absl::StrAppendFormat(&sc->out(), "server %s %s\n",
+                            info->default_sink_name ? info->default_sink_name
+                                                    : "",
+                            info->default_source_name
+                                ? info->default_source_name
+                                : "");
+    sc->Complete(std::unique_ptr<Request>(req));
+  }
+  void Complete(const std::unique_ptr<Request> req) {
+    coalescer_->Done(req->key);
+    if (!Flush()) quit(1);
+  }
+
+  const pa_usec_t window_;
+  std::optional<EventCoalescer> coalescer_;
+};
+
+// Returns a non-blocking socket listening at addr, or -1. Refuses to steal
+// the address from a live listener, but cleans up after a dead one.
+int Listen(const sockaddr_un &addr) {
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) ==
+      0) {
+    close(fd);
+    return -1;
+  }
+  unlink(addr.sun_path);
+  if (bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+class DaemonSubcommand final : public Subcommand,
+                               private Caster<DaemonSubcommand> {
  public:
-  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
-    if (!IsValid(T::kName, args)) return {};
+  static inline constexpr absl::string_view kName = "daemon";
+  static std::unique_ptr<DaemonSubcommand> Build(
+      absl::Span<const absl::string_view> args) {
+    if (!IsValid(kName, args)) return {};
     if (!args.empty()) return {};
-    return std::unique_ptr<T>(new T());
+    return std::unique_ptr<DaemonSubcommand>(new DaemonSubcommand());
   }
   static std::string Usage(absl::string_view argv0) {
-    return absl::StrCat(argv0, " ", T::kName);
+    return absl::StrCat(argv0, " ", kName);
+  }
+  // Events are owned by the mainloop, which is gone by the time this runs.
+  ~DaemonSubcommand() final {
+    if (fd_ >= 0) close(fd_);
   }
+  [[nodiscard]] bool resident() const final { return true; }
+  // With --retry, the socket stays open while the server is away, and
+  // requests are handed back to their clients to make themselves.
+  [[nodiscard]] bool reconnects() const final { return true; }
   void Run(pa_context *const ctx) final {
-    WrapUniqueOperation(
-        Traits::GetInfo(ctx, Traits::kDefaultName, GetMuteCB, this));
+    ctx_ = ctx;
+    abandoned_.clear();
+    InfoCache::Start(api(), ctx);
+    if (fd_ >= 0) return;
+    sockaddr_un addr;
+    if (!paknob::DaemonAddress(&addr)) return quit(1);
+    fd_ = Listen(addr);
+    if (fd_ < 0) return quit(1);
+    if (!api()->io_new(api(), fd_, PA_IO_EVENT_INPUT, AcceptCB, this))
+      return quit(1);
+  }
+  // Requests in flight will never be answered. Those that haven't sent a
+  // change can still be made by their clients. Their subcommands may yet be
+  // called back from the mainloop, so are kept until the next connection.
+  void Disconnected() final {
+    ctx_ = nullptr;
+    InfoCache::Stop();
+    for (const auto &client : clients_) {
+      if (auto sc = client->Abandon()) abandoned_.push_back(std::move(sc));
+    }
   }
-
- protected:
-  explicit GetMuteSubcommand() {}
 
  private:
-  static void GetMuteCB(pa_context *const ctx,
-                        const typename Traits::InfoT *const info,
-                        const int is_last, void *const userdata) {
-    const auto sc = T::Cast(userdata);
-    if (is_last < 0) return sc->quit(1);
-    if (is_last) return;
-    PrintMute(info->mute);
-    Drain(ctx);
+  class Client : private Caster<Client> {
+   public:
+    explicit Client(DaemonSubcommand *const daemon, const int fd)
+        : daemon_{daemon}, fd_{fd}, event_{nullptr} {}
+    ~Client() { close(fd_); }
+    bool Start() {
+      event_ = daemon_->api()->io_new(daemon_->api(), fd_, PA_IO_EVENT_INPUT,
+                                      ReadCB, this);
+      return event_;
+    }
+    // Gives up on the request in flight, if there is one, and returns its
+    // subcommand, which no longer answers.
+    std::unique_ptr<Subcommand> Abandon() {
+      if (!sc_ || sc_->finished()) return {};
+      Reply(sc_->retryable() ? paknob::kDaemonUnavailable : EXIT_FAILURE, {});
+      sc_->set_done([](pa_context *, int, absl::string_view) {});
+      return std::move(sc_);
+    }
+
+   private:
+    static inline constexpr size_t kMaxRequest = 4096;
+    static void ReadCB(pa_mainloop_api *const api, pa_io_event *, const int fd,
+                       pa_io_event_flags_t, void *const userdata) {
+      const auto c = Cast(userdata);
+      char buf[512];
+      const ssize_t n = read(fd, buf, sizeof(buf));
+      if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+      if (n > 0 && c->req_.size() + n <= kMaxRequest) {
+        c->req_.append(buf, n);
+        return;
+      }
+      api->io_free(c->event_);
+      c->event_ = nullptr;
+      if (n != 0) return c->Remove();
+      c->Dispatch();
+    }
+    void Dispatch() {
+      std::vector<absl::string_view> args;
+      for (absl::string_view req = req_; !req.empty();) {
+        const size_t end = req.find('\0');
+        if (end == req.npos) return Reply(EXIT_FAILURE, {});
+        args.push_back(req.substr(0, end));
+        req.remove_prefix(end + 1);
+      }
+      if (!daemon_->ctx_) return Reply(paknob::kDaemonUnavailable, {});
+      sc_ = Subcommand::Build(args);
+      if (!sc_ || sc_->resident()) return Reply(EXIT_FAILURE, {});
+      sc_->set_api(daemon_->api());
+      sc_->set_done([this](pa_context *, const int ret,
+                           const absl::string_view out) { Reply(ret, out); });
+      sc_->Run(daemon_->ctx_);
+    }
+    void Reply(const int ret, const absl::string_view out) {
+      std::string reply(1, static_cast<char>(ret));
+      reply.append(out.data(), out.size());
+      paknob::WriteAll(fd_, reply);
+      Remove();
+    }
+    // Deferred, since this may be running inside a callback of sc_.
+    void Remove() {
+      pa_mainloop_api_once(daemon_->api(), RemoveCB, this);
+    }
+    static void RemoveCB(pa_mainloop_api *, void *const userdata) {
+      const auto c = Cast(userdata);
+      auto &clients = c->daemon_->clients_;
+      clients.erase(std::find_if(
+          clients.begin(), clients.end(),
+          [c](const std::unique_ptr<Client> &p) { return p.get() == c; }));
+    }
+
+    DaemonSubcommand *const daemon_;
+    const int fd_;
+    pa_io_event *event_;
+    std::string req_;
+    std::unique_ptr<Subcommand> sc_;
+  };
+
+  explicit DaemonSubcommand() : ctx_{nullptr}, fd_{-1} {}
+  static void AcceptCB(pa_mainloop_api *, pa_io_event *, const int fd,
+                       pa_io_event_flags_t, void *const userdata) {
+    const auto d = Cast(userdata);
+    const int client_fd =
+        accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) return;
+    auto client = std::make_unique<Client>(d, client_fd);
+    if (!client->Start()) return;
+    d->clients_.push_back(std::move(client));
   }
-};
-class GetSinkMuteSubcommand final
-    : public GetMuteSubcommand<GetSinkMuteSubcommand, SinkTraits> {
- public:
-  static inline constexpr absl::string_view kName = "get-sink-mute";
-  using GetMuteSubcommand::GetMuteSubcommand;
-};
-class GetSourceMuteSubcommand final
-    : public GetMuteSubcommand<GetSourceMuteSubcommand, SourceTraits> {
- public:
-  static inline constexpr absl::string_view kName = "get-source-mute";
-  using GetMuteSubcommand::GetMuteSubcommand;
+
+  pa_context *ctx_;
+  int fd_;
+  std::vector<std::unique_ptr<Client>> clients_;
+  std::vector<std::unique_ptr<Subcommand>> abandoned_;
 };
 
-template <typename T, typename Traits>
-class SetMuteSubcommand : public Subcommand, private Caster<T> {
+// Shares one subscription among any number of listeners, sending each a line
+// whenever the default devices change. A listener that can't keep up gets
+// the latest line once it catches up, rather than every line in between.
+class HubSubcommand final : public DefaultsSubcommand,
+                            private Caster<HubSubcommand> {
  public:
-  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
-    if (!IsValid(T::kName, args)) return {};
-    if (args.size() != 1) return {};
-    bool mute;
-    if (!absl::SimpleAtob(args.front(), &mute)) return {};
-    return std::unique_ptr<T>(new T(mute));
+  static inline constexpr absl::string_view kName = "hub";
+  static std::unique_ptr<HubSubcommand> Build(
+      absl::Span<const absl::string_view> args) {
+    if (!IsValid(kName, args)) return {};
+    if (args.size() > 1) return {};
+    return std::unique_ptr<HubSubcommand>(
+        new HubSubcommand(args.empty() ? kDefaultStatusFormat : args.front()));
   }
   static std::string Usage(absl::string_view argv0) {
-    return absl::StrCat(argv0, " ", T::kName, " <0|1>");
+    return absl::StrCat(argv0, " ", kName, " [<format>]");
+  }
+  // Events are owned by the mainloop, which is gone by the time this runs.
+  ~HubSubcommand() final {
+    if (fd_ >= 0) close(fd_);
   }
   void Run(pa_context *const ctx) final {
-    WrapUniqueOperation(
-        Traits::GetInfo(ctx, Traits::kDefaultName, GetInfoCB, this));
+    sockaddr_un addr;
+    if (!paknob::HubAddress(&addr)) return quit(1);
+    fd_ = Listen(addr);
+    if (fd_ < 0) return quit(1);
+    if (!api()->io_new(api(), fd_, PA_IO_EVENT_INPUT, AcceptCB, this))
+      return quit(1);
+    DefaultsSubcommand::Run(ctx);
   }
 
- protected:
-  explicit SetMuteSubcommand(const bool mute) : mute_{mute} {}
-
  private:
-  static void GetInfoCB(pa_context *const ctx,
-                        const typename Traits::InfoT *const info,
-                        const int is_last, void *const userdata) {
-    const auto sc = T::Cast(userdata);
-    if (is_last < 0) return sc->quit(1);
-    if (is_last) return;
-    sc->vol_ = sc->mute_ ? PA_VOLUME_MUTED : pa_cvolume_avg(&info->volume);
-    WrapUniqueOperation(
-        Traits::SetMute(ctx, Traits::kDefaultName, sc->mute_, SetMuteCB, sc));
+  class Listener : private Caster<Listener> {
+   public:
+    explicit Listener(HubSubcommand *const hub, const int fd)
+        : hub_{hub}, fd_{fd}, event_{nullptr} {}
+    ~Listener() { close(fd_); }
+    bool Start() {
+      event_ = hub_->api()->io_new(hub_->api(), fd_, PA_IO_EVENT_INPUT, IoCB,
+                                   this);
+      return event_;
+    }
+    // At most one line waits behind the one being sent.
+    void Send(const absl::string_view line) {
+      if (!event_) return;
+      if (!sending_.empty()) {
+        next_.assign(line.data(), line.size());
+        return;
+      }
+      sending_.assign(line.data(), line.size());
+      Write();
+    }
+
+   private:
+    // Listeners have nothing to say, so input only means they are gone.
+    static void IoCB(pa_mainloop_api *, pa_io_event *, const int fd,
+                     const pa_io_event_flags_t flags, void *const userdata) {
+      const auto l = Cast(userdata);
+      if (flags &
+          (PA_IO_EVENT_INPUT | PA_IO_EVENT_HANGUP | PA_IO_EVENT_ERROR)) {
+        char buf[64];
+        const ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN))
+          return l->Remove();
+      }
+      if (flags & PA_IO_EVENT_OUTPUT) l->Write();
+    }
+    void Write() {
+      while (!sending_.empty()) {
+        const ssize_t n = send(fd_, sending_.data(), sending_.size(),
+                               MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) break;
+        if (n <= 0) return Remove();
+        sending_.erase(0, n);
+        if (sending_.empty()) sending_.swap(next_);
+      }
+      hub_->api()->io_enable(
+          event_, static_cast<pa_io_event_flags_t>(
+                      PA_IO_EVENT_INPUT |
+                      (sending_.empty() ? 0 : PA_IO_EVENT_OUTPUT)));
+    }
+    // Deferred, since the hub may be iterating over its listeners.
+    void Remove() {
+      hub_->api()->io_free(event_);
+      event_ = nullptr;
+      pa_mainloop_api_once(hub_->api(), RemoveCB, this);
+    }
+    static void RemoveCB(pa_mainloop_api *, void *const userdata) {
+      const auto l = Cast(userdata);
+      auto &listeners = l->hub_->listeners_;
+      listeners.erase(std::find_if(
+          listeners.begin(), listeners.end(),
+          [l](const std::unique_ptr<Listener> &p) { return p.get() == l; }));
+    }
+
+    HubSubcommand *const hub_;
+    const int fd_;
+    pa_io_event *event_;
+    std::string sending_;
+    std::string next_;
+  };
+
+  explicit HubSubcommand(const absl::string_view format)
+      : format_{format}, fd_{-1} {}
+  static void AcceptCB(pa_mainloop_api *, pa_io_event *, const int fd,
+                       pa_io_event_flags_t, void *const userdata) {
+    const auto h = Caster<HubSubcommand>::Cast(userdata);
+    const int listener_fd =
+        accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (listener_fd < 0) return;
+    auto listener = std::make_unique<Listener>(h, listener_fd);
+    if (!listener->Start()) return;
+    listener->Send(h->line_);
+    h->listeners_.push_back(std::move(listener));
   }
-  static void SetMuteCB(pa_context *const ctx, const int success,
-                        void *const userdata) {
-    const auto sc = T::Cast(userdata);
-    if (!success) return sc->quit(1);
-    PrintVolume(sc->vol_);
-    Drain(ctx);
+  static DeviceStatus Convert(const Device &d) {
+    if (!d.present) return {-1, -1, d.name};
+    return {d.volume, d.mute, d.name};
+  }
+  void Changed() final {
+    line_ = FormatStatus(format_, Convert(sink()), Convert(source()));
+    for (const auto &listener : listeners_) listener->Send(line_);
   }
 
-  bool mute_;
-  pa_volume_t vol_;
-};
-class SetSinkMuteSubcommand final
-    : public SetMuteSubcommand<SetSinkMuteSubcommand, SinkTraits> {
- public:
-  static inline constexpr absl::string_view kName = "set-sink-mute";
-  using SetMuteSubcommand::SetMuteSubcommand;
-};
-class SetSourceMuteSubcommand final
-    : public SetMuteSubcommand<SetSourceMuteSubcommand, SourceTraits> {
- public:
-  static inline constexpr absl::string_view kName = "set-source-mute";
-  using SetMuteSubcommand::SetMuteSubcommand;
+  const std::string format_;
+  int fd_;
+  std::string line_;
+  std::vector<std::unique_ptr<Listener>> listeners_;
 };
 
-template <typename T, typename Traits>
-class ToggleMuteSubcommand : public Subcommand, private Caster<T> {
+// Prints what `paknob hub` sends, without connecting to the server.
+class HubListenSubcommand final : public Subcommand {
  public:
-  static std::unique_ptr<T> Build(absl::Span<const absl::string_view> args) {
-    if (!IsValid(T::kName, args)) return {};
+  static inline constexpr absl::string_view kName = "hub-listen";
+  static std::unique_ptr<HubListenSubcommand> Build(
+      absl::Span<const absl::string_view> args) {
+    if (!IsValid(kName, args)) return {};
     if (!args.empty()) return {};
-    return std::unique_ptr<T>(new T());
+    return std::unique_ptr<HubListenSubcommand>(new HubListenSubcommand());
   }
   static std::string Usage(absl::string_view argv0) {
-    return absl::StrCat(argv0, " ", T::kName);
+    return absl::StrCat(argv0, " ", kName);
   }
-  void Run(pa_context *const ctx) final {
-    WrapUniqueOperation(
-        Traits::GetInfo(ctx, Traits::kDefaultName, GetInfoCB, this));
+  // There is nothing to do through a daemon or alongside other subcommands.
+  void Run(pa_context *const ctx) final { Finish(ctx, 1); }
+  std::optional<int> RunOffline() final {
+    sockaddr_un addr;
+    if (!paknob::HubAddress(&addr)) return EXIT_FAILURE;
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return EXIT_FAILURE;
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) !=
+        0) {
+      close(fd);
+      return EXIT_FAILURE;
+    }
+    // The hub closing the connection as it exits is a clean end; losing it
+    // or stdout is not.
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+      if (n < 0) continue;
+      out().append(buf, n);
+      if (!Flush()) break;
+    }
+    close(fd);
+    return n == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 
- protected:
-  explicit ToggleMuteSubcommand() {}
-
  private:
-  static void GetInfoCB(pa_context *const ctx,
-                        const typename Traits::InfoT *const info,
-                        const int is_last, void *const userdata) {
-    const auto sc = T::Cast(userdata);
-    if (is_last < 0) return sc->quit(1);
-    if (is_last) return;
-    sc->vol_ = !info->mute ? PA_VOLUME_MUTED : pa_cvolume_avg(&info->volume);
-    WrapUniqueOperation(
-        Traits::SetMute(ctx, Traits::kDefaultName, !info->mute, SetMuteCB, sc));
+  explicit HubListenSubcommand() {}
+};
+
+class MultiSubcommand final : public Subcommand {
+ public:
+  static inline constexpr absl::string_view kSeparator = "--";
+  explicit MultiSubcommand(std::vector<std::unique_ptr<Subcommand>> scs)
+      : scs_{std::move(scs)}, results_(scs_.size()), remaining_{scs_.size()} {}
+  static std::string Usage(absl::string_view argv0) {
+    return absl::StrCat(argv0, " <subcommand> ", kSeparator,
+                        " <subcommand>...");
   }
-  static void SetMuteCB(pa_context *const ctx, const int success,
-                        void *const userdata) {
-    const auto sc = T::Cast(userdata);
-    if (!success) return sc->quit(1);
-    PrintVolume(sc->vol_);
-    Drain(ctx);
+  void Run(pa_context *const ctx) final {
+    for (size_t i = 0; i < scs_.size(); i++) {
+      scs_[i]->set_api(api());
+      scs_[i]->set_done([this, i](pa_context *const ctx, const int ret,
+                                  const absl::string_view out) {
+        results_[i] = {ret, std::string(out)};
+        if (--remaining_ == 0) Complete(ctx);
+      });
+    }
+    for (const auto &sc : scs_) sc->Run(ctx);
+  }
+  [[nodiscard]] bool retryable() const final {
+    return std::all_of(
+        scs_.begin(), scs_.end(),
+        [](const std::unique_ptr<Subcommand> &sc) { return sc->retryable(); });
   }
 
-  pa_volume_t vol_;
-};
-class ToggleSinkMuteSubcommand final
-    : public ToggleMuteSubcommand<ToggleSinkMuteSubcommand, SinkTraits> {
- public:
-  static inline constexpr absl::string_view kName = "toggle-sink-mute";
-  using ToggleMuteSubcommand::ToggleMuteSubcommand;
+ private:
+  // Results are reported in argument order, whatever order they came in.
+  void Complete(pa_context *const ctx) {
+    int ret = EXIT_SUCCESS;
+    for (const auto &[sc_ret, sc_out] : results_) {
+      absl::StrAppend(&out(), sc_out);
+      if (ret == EXIT_SUCCESS) ret = sc_ret;
+    }
+    Finish(ctx, ret);
+  }
+
+  std::vector<std::unique_ptr<Subcommand>> scs_;
+  std::vector<std::pair<int, std::string>> results_;
+  size_t remaining_;
 };
-class ToggleSourceMuteSubcommand final
-    : public ToggleMuteSubcommand<ToggleSourceMuteSubcommand, SourceTraits> {
+
+// Runs a subcommand again and again on one connection, for --repeat. Each run
+// is built afresh, so none can lean on state left by the last.
+class RepeatSubcommand final : public Subcommand {
  public:
-  static inline constexpr absl::string_view kName = "toggle-source-mute";
-  using ToggleMuteSubcommand::ToggleMuteSubcommand;
+  static std::unique_ptr<RepeatSubcommand> Build(
+      std::unique_ptr<Subcommand> sc, absl::Span<const absl::string_view> args,
+      const uint64_t count) {
+    if (sc->resident()) return {};
+    return std::unique_ptr<RepeatSubcommand>(
+        new RepeatSubcommand(std::move(sc), args, count));
+  }
+  void Run(pa_context *const ctx) final {
+    ctx_ = ctx;
+    sc_->set_api(api());
+    sc_->set_done([this](pa_context *const ctx, const int ret,
+                         const absl::string_view out) {
+      Stats::Run();
+      absl::StrAppend(&this->out(), out);
+      if (ret != EXIT_SUCCESS) return Finish(ctx, ret);
+      if (--remaining_ == 0) return Finish(ctx);
+      if (!Flush()) return Finish(ctx, 1);
+      pa_mainloop_api_once(api(), NextCB, this);
+    });
+    sc_->Run(ctx);
+  }
+  // Runs that are done have been printed, so aren't to be run again.
+  [[nodiscard]] bool retryable() const final {
+    return remaining_ == count_ && sc_->retryable();
+  }
+
+ private:
+  explicit RepeatSubcommand(std::unique_ptr<Subcommand> sc,
+                            absl::Span<const absl::string_view> args,
+                            const uint64_t count)
+      : sc_{std::move(sc)}, args_{args}, count_{count}, remaining_{count} {}
+  // Out of the last run's callback, which belongs to the run being replaced.
+  static void NextCB(pa_mainloop_api *, void *const userdata) {
+    auto *const that = reinterpret_cast<RepeatSubcommand *>(userdata);
+    that->sc_ = Subcommand::Build(that->args_);
+    that->Run(that->ctx_);
+  }
+
+  std::unique_ptr<Subcommand> sc_;
+  const absl::Span<const absl::string_view> args_;
+  const uint64_t count_;
+  uint64_t remaining_;
+  pa_context *ctx_ = nullptr;
 };
 
 std::unique_ptr<Subcommand> Subcommand::Build(
+    absl::Span<const absl::string_view> args) {
+  std::vector<std::unique_ptr<Subcommand>> scs;
+  while (true) {
+    const auto end =
+        std::find(args.begin(), args.end(), MultiSubcommand::kSeparator);
+    auto sc = BuildOne(args.subspan(0, end - args.begin()));
+    if (!sc) return {};
+    scs.push_back(std::move(sc));
+    if (end == args.end()) break;
+    args.remove_prefix(end - args.begin() + 1);
+  }
+  if (scs.size() == 1) return std::move(scs.front());
+  for (const auto &sc : scs) {
+    if (sc->resident()) return {};
+  }
+  return std::make_unique<MultiSubcommand>(std::move(scs));
+}
+
+std::unique_ptr<Subcommand> Subcommand::BuildOne(
     const absl::Span<const absl::string_view> args) {
   if (auto cmd = GetSinkVolumeSubcommand::Build(args); cmd) return cmd;
   if (auto cmd = SetSinkVolumeSubcommand::Build(args); cmd) return cmd;
@@ -466,6 +3533,19 @@ std::unique_ptr<Subcommand> Subcommand::Build(
   if (auto cmd = GetSourceMuteSubcommand::Build(args); cmd) return cmd;
   if (auto cmd = SetSourceMuteSubcommand::Build(args); cmd) return cmd;
   if (auto cmd = ToggleSourceMuteSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = StatusSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = FollowSinkSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = FollowSourceSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = KnobSinkSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = KnobSourceSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = EvdevSinkSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = EvdevSourceSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = WatchEventsSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = DaemonSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = PublishSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = PeekSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = HubSubcommand::Build(args); cmd) return cmd;
+  if (auto cmd = HubListenSubcommand::Build(args); cmd) return cmd;
   return {};
 }
 
@@ -512,27 +3592,57 @@ std::string Subcommand::Usage(absl::string_view argv0) {
       SetSourceMuteSubcommand::Usage(argv0),
       "\n"
       "  ",
-      ToggleSourceMuteSubcommand::Usage(argv0), "\n");
-}
-
-void ContextCB(pa_context *const ctx, void *const userdata) {
-  Subcommand *const sc = reinterpret_cast<Subcommand *>(userdata);
-  switch (pa_context_get_state(ctx)) {
-    case PA_CONTEXT_CONNECTING:
-    case PA_CONTEXT_AUTHORIZING:
-    case PA_CONTEXT_SETTING_NAME:
-      return;
-    case PA_CONTEXT_READY:
-      return sc->Run(ctx);
-    case PA_CONTEXT_TERMINATED:
-      return sc->quit(0);
-    case PA_CONTEXT_FAILED:
-    default:
-      return sc->quit(1);
-  }
+      ToggleSourceMuteSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      StatusSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      FollowSinkSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      FollowSourceSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      KnobSinkSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      KnobSourceSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      EvdevSinkSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      EvdevSourceSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      WatchEventsSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      DaemonSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      PublishSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      PeekSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      HubSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      HubListenSubcommand::Usage(argv0),
+      "\n"
+      "  ",
+      MultiSubcommand::Usage(argv0), "\n");
 }
 
-void HandleSignal(pa_mainloop_api *const m, pa_signal_event *, int, void *) {
+void HandleSignal(pa_mainloop_api *const m, pa_signal_event *, int,
+                  void *const userdata) {
+  if (userdata) reinterpret_cast<Subcommand *>(userdata)->Stop();
+  Server::Close();
+  Tracer::Report(EXIT_SUCCESS);
+  Stats::Report();
   if (m) m->quit(m, 0);
   exit(0);
 }
@@ -544,23 +3654,353 @@ std::vector<absl::string_view> Args(const int argc, char **const argv) {
   for (int i = 0; i < argc && argv[i]; i++) args.emplace_back(argv[i]);
   return args;
 }
-}  // namespace
+struct Options {
+  // Where to report phase timings: empty for stderr, unset for nowhere.
+  std::optional<std::string> trace;
+  // How long to wait for the connection to be ready, and for each operation.
+  std::optional<pa_usec_t> connect_timeout;
+  std::optional<pa_usec_t> timeout;
+  bool autospawn = true;
+  bool control_only = false;
+  // Where to record what the server says, or to play it back from instead.
+  std::optional<std::string> record;
+  std::optional<std::string> replay;
+  bool realtime = false;
+  // Whether to ask the server itself rather than a daemon.
+  bool fresh = false;
+  // How many times to run the subcommand, and where to report counters.
+  uint64_t repeat = 1;
+  std::optional<std::string> stats;
+  // How long to keep connecting again after the connection fails.
+  std::optional<pa_usec_t> retry;
+};
 
-int main(const int argc, char **const argv) {
-  auto args = Args(argc, argv);
-  auto sc = Subcommand::Build(absl::MakeSpan(args).subspan(1));
-  if (!sc) {
-    fputs(Subcommand::Usage(args.empty() ? "paknob" : args.front()).c_str(),
-          stderr);
-    return EXIT_FAILURE;
+std::string OptionsUsage() {
+  return absl::StrFormat(
+      "Options:\n"
+      "  --trace[=<file>]        print phase timings to stderr, or append "
+      "them to <file> as JSON\n"
+      "  --connect-timeout=<ms>  exit with %d if not connected in time\n"
+      "  --timeout=<ms>          exit with %d if any operation takes longer\n"
+      "  --no-autospawn          fail at once if no server is running\n"
+      "  --control-only          don't set up shared memory for audio\n"
+      "  --record=<file>         save what the server says to <file>\n"
+      "  --replay=<file>         play back <file> instead of connecting\n"
+      "  --realtime              replay with the recorded timing\n"
+      "  --fresh                 ask the server, not a running daemon\n"
+      "  --repeat=<n>            run the subcommand <n> times on one "
+      "connection\n"
+      "  --stats[=<file>]        print counters to stderr, or write them to "
+      "<file>, at exit\n"
+      "  --retry=<ms>            connect again for up to <ms> if the "
+      "connection fails\n",
+      paknob::kExitTimeout, paknob::kExitTimeout);
+}
+
+bool ParseMilliseconds(const absl::string_view arg,
+                       std::optional<pa_usec_t> *const usec) {
+  pa_usec_t ms;
+  if (!absl::SimpleAtoi(arg, &ms) || ms == 0) return false;
+  *usec = ms * PA_USEC_PER_MSEC;
+  return true;
+}
+
+// Consumes the options preceding the subcommand. Returns false if any are
+// not understood.
+bool ParseOptions(absl::Span<const absl::string_view> &args,
+                  Options *const options) {
+  while (!args.empty() && absl::StartsWith(args.front(), "--") &&
+         args.front() != MultiSubcommand::kSeparator) {
+    absl::string_view arg = args.front();
+    args.remove_prefix(1);
+    if (arg == "--trace") {
+      options->trace.emplace();
+    } else if (absl::ConsumePrefix(&arg, "--trace=")) {
+      options->trace.emplace(arg);
+    } else if (absl::ConsumePrefix(&arg, "--connect-timeout=")) {
+      if (!ParseMilliseconds(arg, &options->connect_timeout)) return false;
+    } else if (absl::ConsumePrefix(&arg, "--timeout=")) {
+      if (!ParseMilliseconds(arg, &options->timeout)) return false;
+    } else if (arg == "--no-autospawn") {
+      options->autospawn = false;
+    } else if (arg == "--control-only") {
+      options->control_only = true;
+    } else if (absl::ConsumePrefix(&arg, "--record=")) {
+      options->record.emplace(arg);
+    } else if (absl::ConsumePrefix(&arg, "--replay=")) {
+      options->replay.emplace(arg);
+    } else if (arg == "--realtime") {
+      options->realtime = true;
+    } else if (arg == "--fresh") {
+      options->fresh = true;
+    } else if (absl::ConsumePrefix(&arg, "--repeat=")) {
+      if (!absl::SimpleAtoi(arg, &options->repeat) || options->repeat == 0)
+        return false;
+    } else if (arg == "--stats") {
+      options->stats.emplace();
+    } else if (absl::ConsumePrefix(&arg, "--stats=")) {
+      options->stats.emplace(arg);
+    } else if (absl::ConsumePrefix(&arg, "--retry=")) {
+      if (!ParseMilliseconds(arg, &options->retry)) return false;
+    } else {
+      return false;
+    }
+  }
+  return !options->record || !options->replay;
+}
+
+std::unique_ptr<Subcommand> BuildSubcommand(
+    const absl::Span<const absl::string_view> args, const Options &options) {
+  auto sc = Subcommand::Build(args);
+  if (sc && options.repeat > 1)
+    sc = RepeatSubcommand::Build(std::move(sc), args, options.repeat);
+  return sc;
+}
+
+// Connects to the server and runs the subcommand once the connection is
+// ready. With --retry, a connection that fails is made again on the same
+// mainloop after a jittered, exponentially growing delay, until the budget
+// runs out. A one-shot subcommand cut off before its result is built afresh
+// and run again, taking over whatever the old one held, unless it may have
+// sent a change that running again would repeat. A resident one is only
+// waited for until it first runs, unless it reconnects.
+class Connection {
+ public:
+  explicit Connection(Subcommand &sc, const Options &options,
+                      const absl::Span<const absl::string_view> args)
+      : sc_{&sc},
+        options_{options},
+        args_{args},
+        random_(pa_rtclock_now() ^ getpid()) {}
+  bool Connect() {
+    ctx_ = NewUniqueContext(sc_->api(), /* name = */ nullptr);
+    if (!ctx_) return false;
+    Server::SetStateCallback(ctx_.get(), StateCB, this);
+    if (Server::Connect(ctx_.get(), options_.autospawn
+                                        ? PA_CONTEXT_NOFLAGS
+                                        : PA_CONTEXT_NOAUTOSPAWN) < 0)
+      return false;
+    Tracer::Mark("connect");
+    return true;
+  }
+  [[nodiscard]] bool ready() const {
+    return ctx_ && Server::GetState(ctx_.get()) == PA_CONTEXT_READY;
+  }
+
+ private:
+  static inline constexpr pa_usec_t kFirstDelay = 10 * PA_USEC_PER_MSEC;
+  static inline constexpr pa_usec_t kMaxDelay = PA_USEC_PER_SEC;
+
+  static void StateCB(pa_context *const ctx, void *const userdata) {
+    Connection *const that = reinterpret_cast<Connection *>(userdata);
+    switch (Server::GetState(ctx)) {
+      case PA_CONTEXT_CONNECTING:
+        return Tracer::Mark("connecting");
+      case PA_CONTEXT_AUTHORIZING:
+        return Tracer::Mark("authorizing");
+      case PA_CONTEXT_SETTING_NAME:
+        return Tracer::Mark("setting_name");
+      case PA_CONTEXT_READY:
+        Tracer::Mark("ready");
+        // The budget is for each outage, not the whole run.
+        that->retries_ = 0;
+        that->ran_ = true;
+        return that->sc_->Run(ctx);
+      case PA_CONTEXT_TERMINATED:
+        Tracer::Mark("terminated");
+        return that->sc_->quit(0);
+      case PA_CONTEXT_FAILED:
+      default:
+        Tracer::Mark("failed");
+        if (that->ran_) that->sc_->Disconnected();
+        if (that->Retry()) return;
+        return that->sc_->quit(1);
+    }
+  }
+  // Schedules connecting again, unless that is pointless or too late.
+  bool Retry() {
+    // Neither a recording nor a replay would follow a second connection.
+    if (!options_.retry || options_.record || options_.replay) return false;
+    if (ran_ && (sc_->resident() ? !sc_->reconnects()
+                                 : sc_->finished() || !sc_->retryable())) {
+      Tracer::Mark("not_retryable");
+      return false;
+    }
+    const pa_usec_t now = pa_rtclock_now();
+    if (retries_ == 0) first_failure_ = now;
+    const pa_usec_t cap =
+        std::min(kMaxDelay, kFirstDelay << std::min(retries_, 16u));
+    // Half of each delay is random, so that clients which failed together
+    // don't all come back at the same moment.
+    const pa_usec_t delay =
+        std::uniform_int_distribution<pa_usec_t>(cap / 2, cap)(random_);
+    if (now - first_failure_ + delay > *options_.retry) {
+      Tracer::Mark("retry_budget");
+      return false;
+    }
+    timeval tv;
+    pa_timeval_add(pa_gettimeofday(&tv), delay);
+    if (!sc_->api()->time_new(sc_->api(), &tv, RetryCB, this)) return false;
+    retries_++;
+    Stats::Retry();
+    return true;
+  }
+  // Out of the failed context's callback, so that it can be freed.
+  static void RetryCB(pa_mainloop_api *const api, pa_time_event *const timer,
+                      const timeval *, void *const userdata) {
+    api->time_free(timer);
+    Connection *const that = reinterpret_cast<Connection *>(userdata);
+    Tracer::Mark("retry");
+    if (that->ran_ && !that->sc_->resident()) {
+      auto rebuilt = BuildSubcommand(that->args_, that->options_);
+      if (!rebuilt) return api->quit(api, 1);
+      rebuilt->set_api(api);
+      that->sc_->HandOver(*rebuilt);
+      that->rebuilt_ = std::move(rebuilt);
+      that->sc_ = that->rebuilt_.get();
+    }
+    that->ran_ = false;
+    if (!that->Connect()) api->quit(api, 1);
+  }
+
+  Subcommand *sc_;
+  std::unique_ptr<Subcommand> rebuilt_;
+  const Options &options_;
+  const absl::Span<const absl::string_view> args_;
+  UniqueContext ctx_;
+  // Whether the subcommand has run on the current connection.
+  bool ran_ = false;
+  unsigned retries_ = 0;
+  pa_usec_t first_failure_ = 0;
+  std::minstd_rand random_;
+};
+
+// Gives up unless the context became ready in time.
+void ConnectTimeoutCB(pa_mainloop_api *const api, pa_time_event *const timer,
+                      const timeval *, void *const userdata) {
+  api->time_free(timer);
+  if (reinterpret_cast<const Connection *>(userdata)->ready()) return;
+  Tracer::Mark("connect_timeout");
+  api->quit(api, paknob::kExitTimeout);
+}
+
+// The contents of a small file, or nothing if it can't be read.
+std::string ReadFile(const std::string &path) {
+  std::string contents;
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return contents;
+  char buf[1024];
+  for (ssize_t n; (n = read(fd, buf, sizeof(buf))) > 0;)
+    contents.append(buf, n);
+  close(fd);
+  return contents;
+}
+
+// The client.conf that libpulse would read, found the way it looks for one,
+// or nothing if there is none.
+std::string ClientConfigPath() {
+  if (const char *const env = getenv("PULSE_CLIENTCONFIG"); env && *env)
+    return env;
+  std::vector<std::string> paths;
+  const char *const home = getenv("HOME");
+  if (const char *const dir = getenv("XDG_CONFIG_HOME"); dir && *dir)
+    paths.push_back(absl::StrCat(dir, "/pulse/client.conf"));
+  else if (home && *home)
+    paths.push_back(absl::StrCat(home, "/.config/pulse/client.conf"));
+  if (home && *home) paths.push_back(absl::StrCat(home, "/.pulse/client.conf"));
+  paths.push_back("/etc/pulse/client.conf");
+  for (auto &path : paths) {
+    if (access(path.c_str(), R_OK) == 0) return std::move(path);
+  }
+  return {};
+}
+
+// Points libpulse at a client.conf that turns off shared memory, which only
+// streams use, so connecting skips creating and announcing a memory pool.
+// The file includes whatever client.conf and drop-ins would have been read
+// before its own settings, and is written again whenever that changes.
+bool UseControlOnlyConfig() {
+  const std::string path = RuntimePath("paknob-client.conf");
+  if (path.empty()) return false;
+  const std::string user = ClientConfigPath();
+  // Already pointed at ours, by whoever ran us.
+  if (user == path) return true;
+  std::string config;
+  if (!user.empty()) {
+    absl::StrAppend(&config, ".include ", user, "\n");
+    glob_t g;
+    if (glob(absl::StrCat(user, ".d/*.conf").c_str(), 0, nullptr, &g) == 0) {
+      for (size_t i = 0; i < g.gl_pathc; ++i)
+        absl::StrAppend(&config, ".include ", g.gl_pathv[i], "\n");
+    }
+    globfree(&g);
+  }
+  absl::StrAppend(&config, "enable-shm = no\nenable-memfd = no\n");
+  if (ReadFile(path) != config) {
+    const std::string tmp = absl::StrCat(path, ".", getpid());
+    const int fd =
+        open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    const bool ok = write(fd, config.data(), config.size()) ==
+                    static_cast<ssize_t>(config.size());
+    if (close(fd) != 0 || !ok || rename(tmp.c_str(), path.c_str()) != 0) {
+      unlink(tmp.c_str());
+      return false;
+    }
+  }
+  return setenv("PULSE_CLIENTCONFIG", path.c_str(), /* overwrite = */ 1) == 0;
+}
+
+int Execute(Subcommand &sc, const Options &options,
+            const absl::Span<const absl::string_view> args) {
+  if (const auto ret = sc.RunOffline(); ret) {
+    Tracer::Mark("offline");
+    return *ret;
+  }
+  // Neither the daemon nor another invocation would record or replay.
+  if (!sc.resident() && !options.record && !options.replay &&
+      options.repeat == 1) {
+    // The daemon may answer from its cache, which --fresh avoids.
+    if (!options.fresh) {
+      std::string req;
+      for (const auto arg : args)
+        paknob::AppendArg(&req, {arg.data(), arg.size()});
+      const int timeout_ms =
+          options.timeout ? *options.timeout / PA_USEC_PER_MSEC : 0;
+      if (const int ret = paknob::Forward(req, timeout_ms); ret >= 0) {
+        Tracer::Mark("forward");
+        return ret;
+      }
+    }
+    if (const auto ret = sc.Delegate(options.timeout); ret) {
+      Tracer::Mark("delegate");
+      return *ret;
+    }
+#ifdef PAKNOB_PIPEWIRE
+    if (const auto ret = sc.RunPipeWire(options.connect_timeout,
+                                        options.timeout);
+        ret) {
+      Tracer::Mark(*ret == paknob::kExitTimeout ? "timeout" : "pipewire");
+      return *ret;
+    }
+#endif
   }
   const auto m = NewUniqueMainloop();
   if (!m) return EXIT_FAILURE;
-  sc->set_api(pa_mainloop_get_api(m.get()));
-  if (!sc->api()) return EXIT_FAILURE;
-  if (pa_signal_init(sc->api()) != 0) return EXIT_FAILURE;
-  pa_signal_new(SIGINT, HandleSignal, nullptr);
-  pa_signal_new(SIGTERM, HandleSignal, nullptr);
+  pa_mainloop_set_poll_func(m.get(), Stats::Poll, nullptr);
+  sc.set_api(pa_mainloop_get_api(m.get()));
+  if (!sc.api()) return EXIT_FAILURE;
+  if (options.record && !Server::Record(*options.record)) return EXIT_FAILURE;
+  if (options.replay &&
+      !Server::Replay(sc.api(), *options.replay, options.realtime))
+    return EXIT_FAILURE;
+  // One-shot subcommands have nothing to clean up, so the default action of
+  // SIGINT and SIGTERM will do and the signal pipe isn't worth setting up.
+  if (sc.resident()) {
+    if (pa_signal_init(sc.api()) != 0) return EXIT_FAILURE;
+    pa_signal_new(SIGINT, HandleSignal, &sc);
+    pa_signal_new(SIGTERM, HandleSignal, &sc);
+  }
 #ifdef SIGPIPE
   struct sigaction sa;
   memset(&sa, 0, sizeof(sa));
@@ -568,14 +4008,43 @@ int main(const int argc, char **const argv) {
   sa.sa_handler = SIG_IGN;
   if (sigaction(SIGPIPE, &sa, nullptr) != 0) return EXIT_FAILURE;
 #endif
-  const auto ctx = NewUniqueContext(sc->api(), /* name = */ nullptr);
-  if (!ctx) return EXIT_FAILURE;
-  pa_context_set_state_callback(ctx.get(), ContextCB, sc.get());
-  if (pa_context_connect(ctx.get(), /* server = */ nullptr,
-                         static_cast<pa_context_flags_t>(0),
-                         /* api = */ nullptr) < 0)
-    return EXIT_FAILURE;
+  if (options.control_only && !UseControlOnlyConfig()) return EXIT_FAILURE;
+  Connection connection(sc, options, args);
+  if (options.connect_timeout) {
+    timeval tv;
+    pa_timeval_add(pa_gettimeofday(&tv), *options.connect_timeout);
+    if (!sc.api()->time_new(sc.api(), &tv, ConnectTimeoutCB, &connection))
+      return EXIT_FAILURE;
+  }
+  if (options.timeout) Watchdog::Start(sc.api(), *options.timeout);
+  if (!connection.Connect()) return EXIT_FAILURE;
   int ret = EXIT_SUCCESS;
   if (pa_mainloop_run(m.get(), &ret) < 0) return EXIT_FAILURE;
+  if (ret == paknob::kExitTimeout) Tracer::Mark("timeout");
+  // A replay of a resident subcommand ends with the recording, not a signal.
+  if (options.replay && sc.resident()) sc.Stop();
+  return ret;
+}
+}  // namespace
+
+int main(const int argc, char **const argv) {
+  auto args = Args(argc, argv);
+  absl::Span<const absl::string_view> sc_args = absl::MakeSpan(args).subspan(1);
+  Options options;
+  std::unique_ptr<Subcommand> sc;
+  if (ParseOptions(sc_args, &options)) sc = BuildSubcommand(sc_args, options);
+  if (!sc) {
+    const absl::string_view argv0 = args.empty() ? "paknob" : args.front();
+    fputs(absl::StrCat(Subcommand::Usage(argv0), OptionsUsage()).c_str(),
+          stderr);
+    return EXIT_FAILURE;
+  }
+  if (options.trace)
+    Tracer::Start(*options.trace, absl::StrJoin(sc_args, " "));
+  if (options.stats) Stats::Start(*options.stats);
+  const int ret = Execute(*sc, options, sc_args);
+  Server::Close();
+  Tracer::Report(ret);
+  Stats::Report();
   return ret;
 }
@@ -0,0 +1,424 @@
+#include "pipewire.h"
+
+#include <pipewire/extensions/metadata.h>
+#include <pipewire/pipewire.h>
+#include <spa/param/props.h>
+#include <spa/param/route.h>
+#include <spa/pod/builder.h>
+#include <spa/pod/iter.h>
+#include <spa/pod/parser.h>
+#include <spa/utils/json.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "pulse/timeval.h"
+
+namespace paknob {
+namespace pipewire {
+
+struct Connection::Impl {
+  // What the registry says of a node: a sound card's nodes name their device,
+  // and which of its profile's devices they are.
+  struct NodeGlobal {
+    uint32_t id;
+    uint32_t device_id = SPA_ID_INVALID;
+    int32_t profile_device = -1;
+  };
+  struct Node {
+    pw_node *proxy = nullptr;
+    spa_hook listener = {};
+    std::optional<Info> info;
+    uint32_t device_id = SPA_ID_INVALID;
+    int32_t profile_device = -1;
+  };
+  // A device's active Route, which holds the volume and mute state of
+  // whatever its node plays through or records from.
+  struct Route {
+    int32_t index;
+    int32_t device;
+  };
+  struct Device {
+    pw_device *proxy = nullptr;
+    spa_hook listener = {};
+    // The profile device whose Route is wanted, and what was found.
+    int32_t want = -1;
+    std::optional<Route> route;
+  };
+
+  ~Impl() {
+    for (auto &[id, node] : bound) {
+      spa_hook_remove(&node->listener);
+      pw_proxy_destroy(reinterpret_cast<pw_proxy *>(node->proxy));
+    }
+    for (auto &[id, device] : devices) {
+      spa_hook_remove(&device->listener);
+      pw_proxy_destroy(reinterpret_cast<pw_proxy *>(device->proxy));
+    }
+    if (metadata) {
+      spa_hook_remove(&metadata_listener);
+      pw_proxy_destroy(reinterpret_cast<pw_proxy *>(metadata));
+    }
+    if (registry) {
+      spa_hook_remove(&registry_listener);
+      pw_proxy_destroy(reinterpret_cast<pw_proxy *>(registry));
+    }
+    if (core) {
+      spa_hook_remove(&core_listener);
+      pw_core_disconnect(core);
+    }
+    if (context) pw_context_destroy(context);
+    if (timer) pw_loop_destroy_source(pw_main_loop_get_loop(loop), timer);
+    if (loop) pw_main_loop_destroy(loop);
+  }
+
+  // Runs the loop until the server has dealt with everything sent so far,
+  // for no longer than timeout if given. Returns false if it reported an
+  // error meanwhile, or took too long, or a round before this one failed.
+  bool Sync() {
+    if (failed) return false;
+    pending = pw_core_sync(core, PW_ID_CORE, pending);
+    if (timeout) {
+      timespec value = {};
+      value.tv_sec = *timeout / PA_USEC_PER_SEC;
+      value.tv_nsec = *timeout % PA_USEC_PER_SEC * PA_NSEC_PER_USEC;
+      pw_loop_update_timer(pw_main_loop_get_loop(loop), timer, &value,
+                           nullptr, false);
+    }
+    pw_main_loop_run(loop);
+    if (timeout) {
+      pw_loop_update_timer(pw_main_loop_get_loop(loop), timer, nullptr,
+                           nullptr, false);
+    }
+    return !failed;
+  }
+  // The node that a metadata key names, bound with its Props fetched.
+  Node *Find(const char *const key) {
+    const auto name = defaults.find(key);
+    if (name == defaults.end()) return nullptr;
+    const auto global = nodes.find(name->second);
+    if (global == nodes.end()) return nullptr;
+    auto &node = bound[global->second.id];
+    if (!node) {
+      node = std::make_unique<Node>();
+      node->device_id = global->second.device_id;
+      node->profile_device = global->second.profile_device;
+      node->proxy = static_cast<pw_node *>(
+          pw_registry_bind(registry, global->second.id,
+                           PW_TYPE_INTERFACE_Node, PW_VERSION_NODE, 0));
+      if (!node->proxy) return nullptr;
+      pw_node_add_listener(node->proxy, &node->listener, &kNodeEvents,
+                           node.get());
+    }
+    node->info.reset();
+    pw_node_enum_params(node->proxy, 0, SPA_PARAM_Props, 0, UINT32_MAX,
+                        nullptr);
+    if (!Sync() || !node->info) return nullptr;
+    return node.get();
+  }
+  // The device behind a sound card's node, bound with its active Route for
+  // the node fetched, or null for a node of no device, such as a virtual
+  // sink.
+  Device *FindDevice(const Node &node) {
+    if (node.device_id == SPA_ID_INVALID || node.profile_device < 0)
+      return nullptr;
+    auto &device = devices[node.device_id];
+    if (!device) {
+      device = std::make_unique<Device>();
+      device->proxy = static_cast<pw_device *>(
+          pw_registry_bind(registry, node.device_id, PW_TYPE_INTERFACE_Device,
+                           PW_VERSION_DEVICE, 0));
+      if (!device->proxy) return nullptr;
+      pw_device_add_listener(device->proxy, &device->listener, &kDeviceEvents,
+                             device.get());
+    }
+    device->want = node.profile_device;
+    device->route.reset();
+    pw_device_enum_params(device->proxy, 0, SPA_PARAM_Route, 0, UINT32_MAX,
+                          nullptr);
+    if (!Sync() || !device->route) return nullptr;
+    return device.get();
+  }
+  // Writes the volumes or the mute state, whichever isn't null, as
+  // pipewire-pulse does: into the device's Route, where the card keeps it
+  // and restores it, or else into the node's own Props.
+  bool Set(Node *const node, const pa_cvolume *const volume,
+           const bool *const mute) {
+    uint8_t buffer[1024];
+    spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+    spa_pod_frame f[2];
+    Device *const device = FindDevice(*node);
+    if (device) {
+      spa_pod_builder_push_object(&b, &f[0], SPA_TYPE_OBJECT_ParamRoute,
+                                  SPA_PARAM_Route);
+      spa_pod_builder_add(&b, SPA_PARAM_ROUTE_index,
+                          SPA_POD_Int(device->route->index),
+                          SPA_PARAM_ROUTE_device,
+                          SPA_POD_Int(device->route->device), 0);
+      spa_pod_builder_prop(&b, SPA_PARAM_ROUTE_props, 0);
+      spa_pod_builder_push_object(&b, &f[1], SPA_TYPE_OBJECT_Props,
+                                  SPA_PARAM_Route);
+    } else {
+      spa_pod_builder_push_object(&b, &f[1], SPA_TYPE_OBJECT_Props,
+                                  SPA_PARAM_Props);
+    }
+    if (volume) {
+      float volumes[PA_CHANNELS_MAX];
+      for (int i = 0; i < volume->channels; i++)
+        volumes[i] = pa_sw_volume_to_linear(volume->values[i]);
+      spa_pod_builder_prop(&b, SPA_PROP_channelVolumes, 0);
+      spa_pod_builder_array(&b, sizeof(float), SPA_TYPE_Float,
+                            volume->channels, volumes);
+    }
+    if (mute) {
+      spa_pod_builder_prop(&b, SPA_PROP_mute, 0);
+      spa_pod_builder_bool(&b, *mute);
+    }
+    const auto *const props =
+        static_cast<spa_pod *>(spa_pod_builder_pop(&b, &f[1]));
+    if (!device) {
+      pw_node_set_param(node->proxy, SPA_PARAM_Props, 0, props);
+      return Sync();
+    }
+    spa_pod_builder_add(&b, SPA_PARAM_ROUTE_save, SPA_POD_Bool(true), 0);
+    pw_device_set_param(device->proxy, SPA_PARAM_Route, 0,
+                        static_cast<spa_pod *>(spa_pod_builder_pop(&b, &f[0])));
+    return Sync();
+  }
+
+  static void CoreDone(void *const data, const uint32_t id, const int seq) {
+    Impl *const impl = static_cast<Impl *>(data);
+    if (id == PW_ID_CORE && seq == impl->pending) pw_main_loop_quit(impl->loop);
+  }
+  static void CoreError(void *const data, uint32_t, int, int, const char *) {
+    Impl *const impl = static_cast<Impl *>(data);
+    impl->failed = true;
+    pw_main_loop_quit(impl->loop);
+  }
+  static void Timeout(void *const data, uint64_t) {
+    Impl *const impl = static_cast<Impl *>(data);
+    impl->failed = true;
+    impl->timed_out = true;
+    pw_main_loop_quit(impl->loop);
+  }
+  static void Global(void *const data, const uint32_t id, uint32_t,
+                     const char *const type, uint32_t,
+                     const spa_dict *const props) {
+    Impl *const impl = static_cast<Impl *>(data);
+    if (!props) return;
+    if (strcmp(type, PW_TYPE_INTERFACE_Node) == 0) {
+      const char *const name = spa_dict_lookup(props, PW_KEY_NODE_NAME);
+      if (!name) return;
+      NodeGlobal global{id};
+      const char *const device_id = spa_dict_lookup(props, PW_KEY_DEVICE_ID);
+      const char *const profile_device =
+          spa_dict_lookup(props, "card.profile.device");
+      if (device_id && profile_device) {
+        global.device_id = strtoul(device_id, nullptr, 10);
+        global.profile_device = strtol(profile_device, nullptr, 10);
+      }
+      impl->nodes[name] = global;
+    } else if (strcmp(type, PW_TYPE_INTERFACE_Metadata) == 0 &&
+               !impl->metadata) {
+      const char *const name = spa_dict_lookup(props, PW_KEY_METADATA_NAME);
+      if (!name || strcmp(name, "default") != 0) return;
+      impl->metadata = static_cast<pw_metadata *>(pw_registry_bind(
+          impl->registry, id, type, PW_VERSION_METADATA, 0));
+      if (impl->metadata)
+        pw_metadata_add_listener(impl->metadata, &impl->metadata_listener,
+                                 &kMetadataEvents, impl);
+    }
+  }
+  // Values are like {"name":"alsa_output.pci-0000_00_1f.3.analog-stereo"}.
+  static int Property(void *const data, const uint32_t subject,
+                      const char *const key, const char *,
+                      const char *const value) {
+    Impl *const impl = static_cast<Impl *>(data);
+    if (subject != PW_ID_CORE || !key) return 0;
+    impl->defaults.erase(key);
+    if (!value) return 0;
+    spa_json it[2];
+    spa_json_init(&it[0], value, strlen(value));
+    if (spa_json_enter_object(&it[0], &it[1]) <= 0) return 0;
+    char field[64], name[1024];
+    while (spa_json_get_string(&it[1], field, sizeof(field)) > 0 &&
+           spa_json_get_string(&it[1], name, sizeof(name)) > 0) {
+      if (strcmp(field, "name") == 0) {
+        impl->defaults[key] = name;
+        break;
+      }
+    }
+    return 0;
+  }
+  // PipeWire's volumes are linear; PulseAudio's are cubic.
+  static void Param(void *const data, int, const uint32_t id, uint32_t,
+                    uint32_t, const spa_pod *const param) {
+    Node *const node = static_cast<Node *>(data);
+    if (id != SPA_PARAM_Props || node->info ||
+        !spa_pod_is_object_type(param, SPA_TYPE_OBJECT_Props))
+      return;
+    const auto *const obj = reinterpret_cast<const spa_pod_object *>(param);
+    float volumes[PA_CHANNELS_MAX];
+    uint32_t channels = 0;
+    bool mute = false;
+    const spa_pod_prop *prop;
+    SPA_POD_OBJECT_FOREACH(obj, prop) {
+      if (prop->key == SPA_PROP_channelVolumes)
+        channels = spa_pod_copy_array(&prop->value, SPA_TYPE_Float, volumes,
+                                      PA_CHANNELS_MAX);
+      else if (prop->key == SPA_PROP_mute)
+        spa_pod_get_bool(&prop->value, &mute);
+    }
+    // Nodes may have several Props, only one of them with the volumes.
+    if (channels == 0) return;
+    Info info;
+    pa_cvolume_init(&info.volume);
+    info.volume.channels = channels;
+    for (uint32_t i = 0; i < channels; i++)
+      info.volume.values[i] = pa_sw_volume_from_linear(volumes[i]);
+    info.mute = mute;
+    node->info = info;
+  }
+
+  static void RouteParam(void *const data, int, const uint32_t id, uint32_t,
+                         uint32_t, const spa_pod *const param) {
+    Device *const device = static_cast<Device *>(data);
+    Route route;
+    if (id != SPA_PARAM_Route || device->route ||
+        spa_pod_parse_object(param, SPA_TYPE_OBJECT_ParamRoute, nullptr,
+                             SPA_PARAM_ROUTE_index, SPA_POD_Int(&route.index),
+                             SPA_PARAM_ROUTE_device,
+                             SPA_POD_Int(&route.device)) < 0 ||
+        route.device != device->want)
+      return;
+    device->route = route;
+  }
+
+  // Without designated initializers, which C++17 lacks.
+  static pw_core_events CoreEvents() {
+    pw_core_events events = {};
+    events.version = PW_VERSION_CORE_EVENTS;
+    events.done = CoreDone;
+    events.error = CoreError;
+    return events;
+  }
+  static pw_registry_events RegistryEvents() {
+    pw_registry_events events = {};
+    events.version = PW_VERSION_REGISTRY_EVENTS;
+    events.global = Global;
+    return events;
+  }
+  static pw_metadata_events MetadataEvents() {
+    pw_metadata_events events = {};
+    events.version = PW_VERSION_METADATA_EVENTS;
+    events.property = Property;
+    return events;
+  }
+  static pw_node_events NodeEvents() {
+    pw_node_events events = {};
+    events.version = PW_VERSION_NODE_EVENTS;
+    events.param = Param;
+    return events;
+  }
+  static pw_device_events DeviceEvents() {
+    pw_device_events events = {};
+    events.version = PW_VERSION_DEVICE_EVENTS;
+    events.param = RouteParam;
+    return events;
+  }
+
+  static const pw_core_events kCoreEvents;
+  static const pw_registry_events kRegistryEvents;
+  static const pw_metadata_events kMetadataEvents;
+  static const pw_node_events kNodeEvents;
+  static const pw_device_events kDeviceEvents;
+
+  pw_main_loop *loop = nullptr;
+  spa_source *timer = nullptr;
+  std::optional<pa_usec_t> timeout;
+  pw_context *context = nullptr;
+  pw_core *core = nullptr;
+  spa_hook core_listener = {};
+  pw_registry *registry = nullptr;
+  spa_hook registry_listener = {};
+  pw_metadata *metadata = nullptr;
+  spa_hook metadata_listener = {};
+  int pending = 0;
+  bool failed = false;
+  bool timed_out = false;
+  // Metadata keys to node names, and node names to their globals.
+  std::map<std::string, std::string> defaults;
+  std::map<std::string, NodeGlobal> nodes;
+  std::map<uint32_t, std::unique_ptr<Node>> bound;
+  std::map<uint32_t, std::unique_ptr<Device>> devices;
+};
+
+const pw_core_events Connection::Impl::kCoreEvents = CoreEvents();
+const pw_registry_events Connection::Impl::kRegistryEvents =
+    RegistryEvents();
+const pw_metadata_events Connection::Impl::kMetadataEvents =
+    MetadataEvents();
+const pw_node_events Connection::Impl::kNodeEvents = NodeEvents();
+const pw_device_events Connection::Impl::kDeviceEvents = DeviceEvents();
+
+std::unique_ptr<Connection> Connection::Open(
+    const std::optional<pa_usec_t> connect_timeout,
+    const std::optional<pa_usec_t> timeout) {
+  pw_init(nullptr, nullptr);
+  auto impl = std::make_unique<Impl>();
+  impl->loop = pw_main_loop_new(nullptr);
+  if (!impl->loop) return {};
+  impl->timer = pw_loop_add_timer(pw_main_loop_get_loop(impl->loop),
+                                  Impl::Timeout, impl.get());
+  if (!impl->timer) return {};
+  impl->context =
+      pw_context_new(pw_main_loop_get_loop(impl->loop), nullptr, 0);
+  if (!impl->context) return {};
+  impl->core = pw_context_connect(impl->context, nullptr, 0);
+  if (!impl->core) return {};
+  pw_core_add_listener(impl->core, &impl->core_listener, &Impl::kCoreEvents,
+                       impl.get());
+  impl->registry = pw_core_get_registry(impl->core, PW_VERSION_REGISTRY, 0);
+  if (!impl->registry) return {};
+  pw_registry_add_listener(impl->registry, &impl->registry_listener,
+                           &Impl::kRegistryEvents, impl.get());
+  // The first round lists the globals, and the second the metadata's
+  // properties. Taking too long over them is no reason to ask the PulseAudio
+  // server instead, so the connection is kept to say so.
+  impl->timeout = connect_timeout;
+  if ((!impl->Sync() || !impl->Sync()) && !impl->timed_out) return {};
+  impl->timeout = timeout;
+  return std::unique_ptr<Connection>(new Connection(std::move(impl)));
+}
+
+Connection::Connection(std::unique_ptr<Impl> impl) : impl_{std::move(impl)} {}
+Connection::~Connection() = default;
+
+bool Connection::timed_out() const { return impl_->timed_out; }
+
+bool Connection::Get(const char *const key, Info *const info) {
+  Impl::Node *const node = impl_->Find(key);
+  if (!node) return false;
+  *info = *node->info;
+  return true;
+}
+
+bool Connection::SetVolume(const char *const key, const pa_cvolume &volume) {
+  Impl::Node *const node = impl_->Find(key);
+  return node && impl_->Set(node, &volume, nullptr);
+}
+
+bool Connection::SetMute(const char *const key, const bool mute) {
+  Impl::Node *const node = impl_->Find(key);
+  return node && impl_->Set(node, nullptr, &mute);
+}
+
+}  // namespace pipewire
+}  // namespace paknob
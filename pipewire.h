@@ -0,0 +1,55 @@
+#ifndef PAKNOB_PIPEWIRE_H_
+#define PAKNOB_PIPEWIRE_H_
+
+// Reads and changes the default sink's or source's volume and mute state
+// through libpipewire, skipping pipewire-pulse, for builds with
+// PAKNOB_PIPEWIRE. The defaults come from the "default" metadata, and the
+// state is read from the node's Props. Like pipewire-pulse, changes to a
+// sound card's node go to its device's active Route, so that the card keeps
+// them across restarts, and only other nodes have their Props written.
+// Volumes are converted to and from PulseAudio's scale as pipewire-pulse
+// would.
+
+#include <memory>
+#include <optional>
+
+#include "pulse/volume.h"
+
+namespace paknob {
+namespace pipewire {
+
+struct Info {
+  pa_cvolume volume;
+  bool mute;
+};
+
+class Connection {
+ public:
+  // Returns null if PipeWire isn't running, so that the PulseAudio server
+  // should be asked instead. Each round trip to the server may take up to
+  // connect_timeout while connecting and timeout after, if given; one that
+  // takes longer fails, along with every call after it.
+  static std::unique_ptr<Connection> Open(
+      std::optional<pa_usec_t> connect_timeout,
+      std::optional<pa_usec_t> timeout);
+  ~Connection();
+
+  // Whether a round trip took too long, which is why calls fail.
+  [[nodiscard]] bool timed_out() const;
+
+  // key is the metadata key naming the device, like "default.audio.sink".
+  bool Get(const char *key, Info *info);
+  bool SetVolume(const char *key, const pa_cvolume &volume);
+  bool SetMute(const char *key, bool mute);
+
+ private:
+  struct Impl;
+  explicit Connection(std::unique_ptr<Impl> impl);
+
+  std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace pipewire
+}  // namespace paknob
+
+#endif  // PAKNOB_PIPEWIRE_H_
@@ -0,0 +1,116 @@
+#ifndef PAKNOB_PROTOCOL_H_
+#define PAKNOB_PROTOCOL_H_
+
+// The protocol spoken between paknob clients and `paknob daemon`. This is
+// shared with paknob-client, so it must not depend on libpulse or Abseil.
+//
+// The daemon listens on a UNIX socket in the runtime directory. A request is
+// the subcommand's arguments, each terminated by a NUL byte, followed by a
+// write shutdown; the reply is one byte of exit status followed by whatever
+// the subcommand printed. A daemon that has lost its server connection
+// replies kDaemonUnavailable instead, to requests it hadn't yet sent a
+// change for, and the client then makes the request itself.
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace paknob {
+
+// Exit status when a deadline expires, as timeout(1) uses.
+inline constexpr int kExitTimeout = 124;
+
+// The daemon's reply status when it can't serve a request; never an exit
+// status.
+inline constexpr unsigned char kDaemonUnavailable = 0xff;
+
+inline bool RuntimeAddress(const char *const name, sockaddr_un *const addr) {
+  const char *const dir = getenv("XDG_RUNTIME_DIR");
+  if (!dir || !*dir) return false;
+  const std::string path = std::string(dir) + "/" + name;
+  if (path.size() >= sizeof(addr->sun_path)) return false;
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  memcpy(addr->sun_path, path.data(), path.size());
+  return true;
+}
+
+inline bool DaemonAddress(sockaddr_un *const addr) {
+  return RuntimeAddress("paknob.sock", addr);
+}
+
+// Where `paknob hub` sends updates to its listeners, one line each.
+inline bool HubAddress(sockaddr_un *const addr) {
+  return RuntimeAddress("paknob-hub.sock", addr);
+}
+
+inline bool WriteAll(const int fd, std::string_view data) {
+  while (!data.empty()) {
+    const ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data.remove_prefix(n);
+  }
+  return true;
+}
+
+inline bool ReadAll(const int fd, std::string *const data) {
+  char buf[4096];
+  while (true) {
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return false;
+    if (n == 0) return true;
+    data->append(buf, n);
+  }
+}
+
+inline void AppendArg(std::string *const req, const std::string_view arg) {
+  req->append(arg.data(), arg.size());
+  req->push_back('\0');
+}
+
+// Sends a request to a running daemon and prints its reply. Returns the exit
+// status, or -1 if no daemon is listening, or it can't serve the request,
+// and the caller should do the work itself. A non-zero timeout bounds how
+// long to wait for the reply, and for connecting and sending, which give up
+// with -1.
+inline int Forward(const std::string_view req, const int timeout_ms = 0) {
+  sockaddr_un addr;
+  if (!DaemonAddress(&addr)) return -1;
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (timeout_ms > 0) {
+    const timeval tv = {timeout_ms / 1000, timeout_ms % 1000 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  }
+  if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) !=
+          0 ||
+      !WriteAll(fd, req) || shutdown(fd, SHUT_WR) != 0) {
+    close(fd);
+    return -1;
+  }
+  std::string reply;
+  const bool ok = ReadAll(fd, &reply);
+  const bool timed_out = !ok && (errno == EAGAIN || errno == EWOULDBLOCK);
+  close(fd);
+  if (timed_out) return kExitTimeout;
+  if (!ok || reply.empty()) return EXIT_FAILURE;
+  if (static_cast<unsigned char>(reply.front()) == kDaemonUnavailable)
+    return -1;
+  fwrite(reply.data() + 1, 1, reply.size() - 1, stdout);
+  return static_cast<unsigned char>(reply.front());
+}
+
+}  // namespace paknob
+
+#endif  // PAKNOB_PROTOCOL_H_
@@ -0,0 +1,155 @@
+#ifndef PAKNOB_STATE_H_
+#define PAKNOB_STATE_H_
+
+// The mixer state that `paknob publish` keeps in a file in the runtime
+// directory, for readers that want the current volumes without a socket or a
+// server connection. This is plain C so that bars and OSDs can include it; a
+// reader needs no library. It does need O_CLOEXEC and syscall(), which a
+// strict standard mode such as -std=c11 hides unless _GNU_SOURCE or
+// _DEFAULT_SOURCE is defined before the first include; GNU modes and C++
+// have them anyway.
+//
+// The publisher writes under a seqlock: seq is odd while an update is in
+// progress. Each update also increments generation, and then wakes anyone
+// futex-waiting on it. It holds a write lock on the whole file, an open file
+// description lock, for as long as it runs, and publishes no devices before
+// it exits.
+
+#if defined(__STRICT_ANSI__) && !defined(_GNU_SOURCE) && \
+    !defined(_DEFAULT_SOURCE)
+#error "state.h needs _GNU_SOURCE or _DEFAULT_SOURCE in strict modes"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <linux/limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// From <fcntl.h>, which only has it with _GNU_SOURCE.
+#ifndef F_OFD_GETLK
+#define F_OFD_GETLK 36
+#endif
+
+#define PAKNOB_STATE_FILE "paknob.state"
+#define PAKNOB_STATE_MAGIC 0x31736b70u
+#define PAKNOB_STATE_NAME_MAX 128
+// How many times a reader looks for a moment between updates before giving
+// up, which it only does if the publisher died in the middle of one.
+#define PAKNOB_STATE_READ_TRIES 1000
+
+struct paknob_device {
+  // A percentage, and 0 or 1; both -1 if there is no such device.
+  int32_t volume;
+  int32_t mute;
+  // NUL-terminated, and truncated if need be.
+  char name[PAKNOB_STATE_NAME_MAX];
+};
+
+struct paknob_state {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t generation;
+  uint32_t reserved;
+  struct paknob_device sink;
+  struct paknob_device source;
+};
+
+// Maps the published state read-only. Returns NULL if nothing is publishing,
+// including when the last publisher was killed and left its file behind.
+static inline const struct paknob_state *paknob_state_map(void) {
+  const char *const dir = getenv("XDG_RUNTIME_DIR");
+  char path[PATH_MAX];
+  if (!dir || !*dir ||
+      snprintf(path, sizeof(path), "%s/%s", dir, PAKNOB_STATE_FILE) >=
+          (int)sizeof(path))
+    return NULL;
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return NULL;
+  // Asking about the lock doesn't take it, so can't get in a publisher's way.
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = F_RDLCK;
+  lock.l_whence = SEEK_SET;
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fcntl(fd, F_OFD_GETLK, &lock) == 0 && lock.l_type != F_UNLCK &&
+      fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(struct paknob_state))
+    p = mmap(NULL, sizeof(struct paknob_state), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return NULL;
+  const struct paknob_state *const s = (const struct paknob_state *)p;
+  if (__atomic_load_n(&s->magic, __ATOMIC_ACQUIRE) != PAKNOB_STATE_MAGIC) {
+    munmap(p, sizeof(struct paknob_state));
+    return NULL;
+  }
+  return s;
+}
+
+// Copies out a consistent snapshot without blocking the publisher, and its
+// generation if generation is not NULL. Returns 0, or -1 with errno set to
+// EAGAIN if no update ever finished.
+static inline int paknob_state_read(const struct paknob_state *const s,
+                                    struct paknob_device *const sink,
+                                    struct paknob_device *const source,
+                                    uint32_t *const generation) {
+  for (int i = 0; i < PAKNOB_STATE_READ_TRIES; ++i) {
+    const uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      sched_yield();
+      continue;
+    }
+    const uint32_t g = __atomic_load_n(&s->generation, __ATOMIC_RELAXED);
+    memcpy(sink, &s->sink, sizeof(*sink));
+    memcpy(source, &s->source, sizeof(*source));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq) {
+      sink->name[PAKNOB_STATE_NAME_MAX - 1] = '\0';
+      source->name[PAKNOB_STATE_NAME_MAX - 1] = '\0';
+      if (generation) *generation = g;
+      return 0;
+    }
+  }
+  errno = EAGAIN;
+  return -1;
+}
+
+// Blocks until the state has moved on from a generation. Returns 0, or -1
+// with errno set if interrupted.
+static inline int paknob_state_wait(const struct paknob_state *const s,
+                                    const uint32_t generation) {
+  while (__atomic_load_n(&s->generation, __ATOMIC_ACQUIRE) == generation) {
+    if (syscall(SYS_futex, &s->generation, FUTEX_WAIT, generation, NULL, NULL,
+                0) != 0 &&
+        errno != EAGAIN)
+      return -1;
+  }
+  return 0;
+}
+
+// For the publisher: replaces the state and wakes waiters.
+static inline void paknob_state_publish(struct paknob_state *const s,
+                                        const struct paknob_device *const sink,
+                                        const struct paknob_device *const
+                                            source) {
+  const uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(&s->sink, sink, sizeof(*sink));
+  memcpy(&s->source, source, sizeof(*source));
+  __atomic_store_n(&s->generation, s->generation + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&s->magic, PAKNOB_STATE_MAGIC, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &s->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+#endif  // PAKNOB_STATE_H_
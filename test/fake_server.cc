@@ -0,0 +1,502 @@
+#include "fake_server.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+#include "native.h"
+#include "protocol.h"
+
+namespace paknob {
+namespace test {
+namespace {
+
+inline constexpr uint32_t kError = 0;
+inline constexpr uint32_t kReply = 2;
+inline constexpr uint32_t kSubscribeEvent = 66;
+inline constexpr uint32_t kCommandChannel = ~0u;
+inline constexpr uint32_t kInvalidIndex = ~0u;
+inline constexpr size_t kDescriptorSize = 20;
+// Old enough that neither shared memory nor port and format lists come
+// into it, and new enough for proplists and base volumes.
+inline constexpr uint32_t kVersion = 15;
+
+// PA_ERR_COMMAND, PA_ERR_INVALID, PA_ERR_NOENTITY and PA_ERR_INTERNAL.
+inline constexpr uint32_t kErrCommand = 2;
+inline constexpr uint32_t kErrInvalid = 3;
+inline constexpr uint32_t kErrNoEntity = 5;
+inline constexpr uint32_t kErrInternal = 10;
+
+// PA_SUBSCRIPTION_EVENT_SINK and _SOURCE, and _CHANGE.
+inline constexpr uint32_t kFacilitySink = 0;
+inline constexpr uint32_t kFacilitySource = 1;
+inline constexpr uint32_t kEventChange = 0x10;
+
+inline constexpr char kSinkName[] = "fake_sink";
+inline constexpr char kSourceName[] = "fake_source";
+
+// The tags of everything the replies hold, beyond what native::Tagstruct
+// sends.
+class Encoder {
+ public:
+  void U32(const uint32_t val) {
+    data_.push_back('L');
+    Raw32(val);
+  }
+  void Bool(const bool val) { data_.push_back(val ? '1' : '0'); }
+  void String(const std::string_view val) {
+    data_.push_back('t');
+    data_.append(val.data(), val.size());
+    data_.push_back('\0');
+  }
+  void Null() { data_.push_back('N'); }
+  // S16LE at 48 kHz.
+  void SampleSpec(const uint8_t channels) {
+    data_.push_back('a');
+    data_.push_back(3);
+    data_.push_back(static_cast<char>(channels));
+    Raw32(48000);
+  }
+  // Front left, right and so on.
+  void ChannelMap(const uint8_t channels) {
+    data_.push_back('m');
+    data_.push_back(static_cast<char>(channels));
+    for (uint8_t i = 0; i < channels; i++)
+      data_.push_back(static_cast<char>(channels == 1 ? 0 : i + 1));
+  }
+  void CVolume(const std::vector<uint32_t> &volume) {
+    data_.push_back('v');
+    data_.push_back(static_cast<char>(volume.size()));
+    for (const uint32_t v : volume) Raw32(v);
+  }
+  void Volume(const uint32_t val) {
+    data_.push_back('V');
+    Raw32(val);
+  }
+  void Usec(const uint64_t val) {
+    data_.push_back('U');
+    Raw32(val >> 32);
+    Raw32(val);
+  }
+  void EmptyProplist() {
+    data_.push_back('P');
+    Null();
+  }
+  [[nodiscard]] const std::string &data() const { return data_; }
+
+ private:
+  void Raw32(const uint32_t val) {
+    const uint32_t be = htonl(val);
+    data_.append(reinterpret_cast<const char *>(&be), sizeof(be));
+  }
+
+  std::string data_;
+};
+
+Encoder Command(const uint32_t command, const uint32_t tag) {
+  Encoder e;
+  e.U32(command);
+  e.U32(tag);
+  return e;
+}
+
+// A pa_sink_info or pa_source_info as a version 15 client reads it.
+void DeviceInfo(Encoder *const e, const uint32_t index, const char *const name,
+                const Device &device) {
+  const auto channels = static_cast<uint8_t>(device.volume.size());
+  e->U32(index);
+  e->String(name);
+  e->String(name);
+  e->SampleSpec(channels);
+  e->ChannelMap(channels);
+  // Owner module.
+  e->U32(kInvalidIndex);
+  e->CVolume(device.volume);
+  e->Bool(device.mute);
+  // The sink's monitor, or the source's monitored sink.
+  e->U32(kInvalidIndex);
+  e->Null();
+  // Latency, driver and flags.
+  e->Usec(0);
+  e->String("fake_server.cc");
+  e->U32(0);
+  e->EmptyProplist();
+  // Configured latency, base volume, state, volume steps and card.
+  e->Usec(0);
+  e->Volume(kVolumeNorm);
+  e->U32(0);
+  e->U32(kVolumeNorm + 1);
+  e->U32(kInvalidIndex);
+}
+
+}  // namespace
+
+struct FakeServer::Client {
+  struct Out {
+    Clock::time_point due;
+    std::string data;
+  };
+
+  int fd;
+  uint32_t index;
+  std::string in;
+  std::deque<Out> out;
+  uint32_t mask = 0;
+};
+
+std::unique_ptr<FakeServer> FakeServer::Start(const std::string &dir) {
+  const std::string pulse = dir + "/pulse";
+  if (mkdir(pulse.c_str(), 0700) != 0 && errno != EEXIST) return {};
+  std::unique_ptr<FakeServer> server(new FakeServer(pulse + "/native"));
+  if (pipe2(server->wake_, O_CLOEXEC | O_NONBLOCK) != 0) return {};
+  if (!server->Listen()) return {};
+  server->thread_ = std::thread([s = server.get()] { s->Serve(); });
+  return server;
+}
+
+FakeServer::FakeServer(std::string path)
+    : path_{std::move(path)},
+      sink_{{0x8000, 0x8000}, false},
+      source_{{0x10000, 0x10000}, false} {}
+
+FakeServer::~FakeServer() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    quit_ = true;
+    Wake();
+  }
+  if (thread_.joinable()) thread_.join();
+  for (const auto &client : clients_) close(client->fd);
+  if (listen_fd_ >= 0) close(listen_fd_);
+  for (const int fd : wake_) {
+    if (fd >= 0) close(fd);
+  }
+  unlink(path_.c_str());
+}
+
+bool FakeServer::Listen() {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path_.size() >= sizeof(addr.sun_path)) return false;
+  memcpy(addr.sun_path, path_.data(), path_.size());
+  unlink(path_.c_str());
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return false;
+  if (bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, 64) != 0) {
+    close(fd);
+    return false;
+  }
+  listen_fd_ = fd;
+  return true;
+}
+
+void FakeServer::Stop() {
+  std::lock_guard<std::mutex> lock(mu_);
+  for (const auto &client : clients_) close(client->fd);
+  clients_.clear();
+  if (listen_fd_ >= 0) close(listen_fd_);
+  listen_fd_ = -1;
+  unlink(path_.c_str());
+  Wake();
+}
+
+bool FakeServer::Restart() {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (listen_fd_ >= 0) return true;
+  const bool ok = Listen();
+  Wake();
+  return ok;
+}
+
+void FakeServer::set_latency(const std::chrono::milliseconds latency) {
+  std::lock_guard<std::mutex> lock(mu_);
+  latency_ = latency;
+}
+
+void FakeServer::Inject(const uint32_t command, const Fault fault,
+                        const int count) {
+  std::lock_guard<std::mutex> lock(mu_);
+  faults_.push_back({command, fault, count});
+}
+
+Device FakeServer::sink() {
+  std::lock_guard<std::mutex> lock(mu_);
+  return sink_;
+}
+
+Device FakeServer::source() {
+  std::lock_guard<std::mutex> lock(mu_);
+  return source_;
+}
+
+void FakeServer::SetSink(const Device &device) {
+  std::lock_guard<std::mutex> lock(mu_);
+  sink_ = device;
+  Event(kFacilitySink, 0);
+  Wake();
+}
+
+void FakeServer::SetSource(const Device &device) {
+  std::lock_guard<std::mutex> lock(mu_);
+  source_ = device;
+  Event(kFacilitySource, 0);
+  Wake();
+}
+
+void FakeServer::RemoveSink() {
+  std::lock_guard<std::mutex> lock(mu_);
+  has_sink_ = false;
+  Event(kFacilitySink, 0);
+  Wake();
+}
+
+int FakeServer::count(const uint32_t command) {
+  std::lock_guard<std::mutex> lock(mu_);
+  const auto it = counts_.find(command);
+  return it == counts_.end() ? 0 : it->second;
+}
+
+int FakeServer::connections() {
+  std::lock_guard<std::mutex> lock(mu_);
+  return clients_.size();
+}
+
+bool FakeServer::WaitForCount(const uint32_t command, const int n,
+                              const std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mu_);
+  return counted_.wait_for(lock, timeout,
+                           [&] { return counts_[command] >= n; });
+}
+
+// Polls the socket, the clients and the wakeup pipe, sleeping no longer
+// than until the next delayed packet is due.
+void FakeServer::Serve() {
+  uint32_t next_index = 0;
+  std::vector<pollfd> fds;
+  while (true) {
+    int timeout = -1;
+    int listen_fd;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (quit_) return;
+      listen_fd = listen_fd_;
+      fds.assign({{wake_[0], POLLIN, 0}, {listen_fd, POLLIN, 0}});
+      const auto now = Clock::now();
+      for (const auto &client : clients_) {
+        fds.push_back({client->fd, POLLIN, 0});
+        if (client->out.empty()) continue;
+        const auto wait = std::chrono::ceil<std::chrono::milliseconds>(
+            client->out.front().due - now);
+        const int ms = std::max<int>(0, wait.count());
+        timeout = timeout < 0 ? ms : std::min(timeout, ms);
+      }
+    }
+    if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) return;
+    std::lock_guard<std::mutex> lock(mu_);
+    if (fds[0].revents) {
+      char buf[64];
+      while (read(wake_[0], buf, sizeof(buf)) > 0) {
+      }
+    }
+    if (fds[1].revents && listen_fd >= 0 && listen_fd == listen_fd_) {
+      const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        auto client = std::make_unique<Client>();
+        client->fd = fd;
+        client->index = next_index++;
+        clients_.push_back(std::move(client));
+      }
+    }
+    // Clients that Stop closed meanwhile are no longer in clients_.
+    const auto now = Clock::now();
+    for (auto it = clients_.begin(); it != clients_.end();) {
+      Client &client = **it;
+      const auto polled =
+          std::find_if(fds.begin() + 2, fds.end(),
+                       [&](const pollfd &p) { return p.fd == client.fd; });
+      const bool ok = (polled == fds.end() || !polled->revents ||
+                       Read(client)) &&
+                      Flush(client, now);
+      if (ok) {
+        ++it;
+        continue;
+      }
+      close(client.fd);
+      it = clients_.erase(it);
+    }
+  }
+}
+
+bool FakeServer::Read(Client &client) {
+  char buf[4096];
+  const ssize_t n = read(client.fd, buf, sizeof(buf));
+  if (n < 0 && (errno == EINTR || errno == EAGAIN)) return true;
+  if (n <= 0) return false;
+  client.in.append(buf, n);
+  while (client.in.size() >= kDescriptorSize) {
+    uint32_t descriptor[kDescriptorSize / sizeof(uint32_t)];
+    memcpy(descriptor, client.in.data(), sizeof(descriptor));
+    const uint32_t size = ntohl(descriptor[0]);
+    if (client.in.size() < kDescriptorSize + size) break;
+    const std::string packet = client.in.substr(kDescriptorSize, size);
+    client.in.erase(0, kDescriptorSize + size);
+    // Memory blocks, which nothing here sends.
+    if (ntohl(descriptor[1]) != kCommandChannel) continue;
+    if (!Handle(client, packet)) return false;
+  }
+  return true;
+}
+
+bool FakeServer::Handle(Client &client, const std::string &packet) {
+  native::Reader r(packet);
+  uint32_t command, tag;
+  if (!r.U32(&command) || !r.U32(&tag)) return false;
+  counts_[command]++;
+  counted_.notify_all();
+  // Connecting always works, so that faults hit what paknob asks for.
+  Fault fault = Fault::kDrop;
+  const bool faulty = command != kAuth && command != kSetClientName &&
+                      TakeFault(command, &fault);
+  if (faulty && fault == Fault::kDrop) return true;
+  if (faulty && fault == Fault::kDisconnectBefore) return false;
+  const auto error = [&](const uint32_t code) {
+    Encoder e = Command(kError, tag);
+    e.U32(code);
+    Queue(client, e.data());
+    return true;
+  };
+  if (faulty && fault == Fault::kError) return error(kErrInternal);
+  Encoder reply = Command(kReply, tag);
+  // The facility that a change is announced for, once it has been answered.
+  int changed = -1;
+  // Which device a request names, and the facility of its events.
+  const auto find = [&](const bool sink) -> Device * {
+    uint32_t index;
+    std::string_view name;
+    if (!r.U32(&index) || !r.String(&name)) return nullptr;
+    if (sink && !has_sink_) return nullptr;
+    const char *const own = sink ? kSinkName : kSourceName;
+    const char *const def = sink ? "@DEFAULT_SINK@" : "@DEFAULT_SOURCE@";
+    if (index != 0 && name != own && name != def) return nullptr;
+    return sink ? &sink_ : &source_;
+  };
+  switch (command) {
+    case kAuth:
+      reply.U32(kVersion);
+      break;
+    case kSetClientName:
+      reply.U32(client.index);
+      break;
+    case kGetServerInfo:
+      reply.String("paknob");
+      reply.String("localhost");
+      reply.String("15.0");
+      reply.String("fake_server.cc");
+      reply.SampleSpec(2);
+      if (has_sink_) {
+        reply.String(kSinkName);
+      } else {
+        reply.Null();
+      }
+      reply.String(kSourceName);
+      reply.U32(0);
+      reply.ChannelMap(2);
+      break;
+    case kGetSinkInfo:
+    case kGetSourceInfo: {
+      const bool sink = command == kGetSinkInfo;
+      const Device *const device = find(sink);
+      if (!device) return error(kErrNoEntity);
+      DeviceInfo(&reply, 0, sink ? kSinkName : kSourceName, *device);
+      break;
+    }
+    case kSetSinkVolume:
+    case kSetSourceVolume: {
+      const bool sink = command == kSetSinkVolume;
+      Device *const device = find(sink);
+      if (!device) return error(kErrNoEntity);
+      native::CVolume cv;
+      if (!r.Volume(&cv) || cv.channels != device->volume.size())
+        return error(kErrInvalid);
+      device->volume.assign(cv.values, cv.values + cv.channels);
+      changed = sink ? kFacilitySink : kFacilitySource;
+      break;
+    }
+    case kSetSinkMute:
+    case kSetSourceMute: {
+      const bool sink = command == kSetSinkMute;
+      Device *const device = find(sink);
+      bool mute;
+      if (!device) return error(kErrNoEntity);
+      if (!r.Bool(&mute)) return error(kErrInvalid);
+      device->mute = mute;
+      changed = sink ? kFacilitySink : kFacilitySource;
+      break;
+    }
+    case kSubscribe:
+      if (!r.U32(&client.mask)) return error(kErrInvalid);
+      break;
+    default:
+      return error(kErrCommand);
+  }
+  const bool answer = !faulty || fault != Fault::kDisconnectAfter;
+  if (answer) Queue(client, reply.data());
+  if (changed >= 0) Event(changed, 0);
+  return answer;
+}
+
+bool FakeServer::Flush(Client &client, const Clock::time_point now) {
+  while (!client.out.empty() && client.out.front().due <= now) {
+    if (!WriteAll(client.fd, client.out.front().data)) return false;
+    client.out.pop_front();
+  }
+  return true;
+}
+
+void FakeServer::Queue(Client &client, const std::string &payload) {
+  const uint32_t descriptor[kDescriptorSize / sizeof(uint32_t)] = {
+      htonl(payload.size()), htonl(kCommandChannel), 0, 0, 0};
+  std::string packet(reinterpret_cast<const char *>(descriptor),
+                     sizeof(descriptor));
+  packet += payload;
+  client.out.push_back({Clock::now() + latency_, std::move(packet)});
+}
+
+void FakeServer::Event(const uint32_t facility, const uint32_t index) {
+  for (const auto &client : clients_) {
+    if (!(client->mask & (1u << facility))) continue;
+    Encoder e = Command(kSubscribeEvent, kInvalidIndex);
+    e.U32(facility | kEventChange);
+    e.U32(index);
+    Queue(*client, e.data());
+  }
+}
+
+void FakeServer::Wake() {
+  const char c = 0;
+  (void)!write(wake_[1], &c, 1);
+}
+
+bool FakeServer::TakeFault(const uint32_t command, Fault *const fault) {
+  for (auto it = faults_.begin(); it != faults_.end(); ++it) {
+    if (it->command != command && it->command != kAnyCommand) continue;
+    *fault = it->fault;
+    if (--it->count <= 0) faults_.erase(it);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace test
+}  // namespace paknob
@@ -0,0 +1,133 @@
+#ifndef PAKNOB_TEST_FAKE_SERVER_H_
+#define PAKNOB_TEST_FAKE_SERVER_H_
+
+// A PulseAudio server that speaks just enough of the native protocol for
+// paknob, libpaknob and paknob-client: authentication, the client name,
+// server info, a sink and a source got and set by name, and subscription
+// events for their changes. It serves on a thread of its own, at
+// <dir>/pulse/native, which is where libpulse looks with XDG_RUNTIME_DIR set
+// to dir.
+//
+// Faults are injected per command: replies can be delayed, dropped, turned
+// into errors, or the connection closed before or after the command takes
+// effect.
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace paknob {
+namespace test {
+
+// The commands, as libpulse numbers them.
+inline constexpr uint32_t kAuth = 8;
+inline constexpr uint32_t kSetClientName = 9;
+inline constexpr uint32_t kGetServerInfo = 20;
+inline constexpr uint32_t kGetSinkInfo = 21;
+inline constexpr uint32_t kGetSourceInfo = 23;
+inline constexpr uint32_t kSubscribe = 35;
+inline constexpr uint32_t kSetSinkVolume = 36;
+inline constexpr uint32_t kSetSourceVolume = 38;
+inline constexpr uint32_t kSetSinkMute = 39;
+inline constexpr uint32_t kSetSourceMute = 40;
+// Any of the above, for Inject.
+inline constexpr uint32_t kAnyCommand = ~0u;
+
+struct Device {
+  std::vector<uint32_t> volume;
+  bool mute = false;
+};
+
+enum class Fault {
+  // Neither answers nor closes.
+  kDrop,
+  // Answers with an error.
+  kError,
+  // Closes the connection without doing what was asked.
+  kDisconnectBefore,
+  // Does what was asked, then closes the connection without answering.
+  kDisconnectAfter,
+};
+
+class FakeServer {
+ public:
+  // Serves at <dir>/pulse/native until destroyed or stopped. Returns null if
+  // the socket can't be set up.
+  static std::unique_ptr<FakeServer> Start(const std::string &dir);
+  ~FakeServer();
+  FakeServer(const FakeServer &) = delete;
+  FakeServer &operator=(const FakeServer &) = delete;
+
+  // Closes every connection and the socket, as a server that exits would,
+  // and opens the socket again, as one that restarts would. The state is
+  // kept.
+  void Stop();
+  bool Restart();
+
+  // How long every reply and event waits before it is sent.
+  void set_latency(std::chrono::milliseconds latency);
+  // Applies fault to the next count commands of the given kind.
+  void Inject(uint32_t command, Fault fault, int count = 1);
+
+  Device sink();
+  Device source();
+  // Changes a device as another client would, with an event for each.
+  void SetSink(const Device &device);
+  void SetSource(const Device &device);
+  // Without a default sink, requests for it fail as the real server's do.
+  void RemoveSink();
+
+  // How many of a command have been received, faults included.
+  int count(uint32_t command);
+  int connections();
+  // Waits until count(command) reaches n, or the timeout passes.
+  bool WaitForCount(uint32_t command, int n, std::chrono::milliseconds timeout);
+
+ private:
+  struct Client;
+  struct Pending {
+    uint32_t command;
+    Fault fault;
+    int count;
+  };
+  using Clock = std::chrono::steady_clock;
+
+  explicit FakeServer(std::string path);
+  bool Listen();
+  void Serve();
+  // Returns false once the client is to be closed.
+  bool Read(Client &client);
+  bool Handle(Client &client, const std::string &packet);
+  bool Flush(Client &client, Clock::time_point now);
+  void Queue(Client &client, const std::string &payload);
+  void Event(uint32_t facility, uint32_t index);
+  void Wake();
+  bool TakeFault(uint32_t command, Fault *fault);
+
+  const std::string path_;
+  std::mutex mu_;
+  std::condition_variable counted_;
+  int listen_fd_ = -1;
+  int wake_[2] = {-1, -1};
+  bool quit_ = false;
+  std::chrono::milliseconds latency_{0};
+  std::deque<Pending> faults_;
+  std::map<uint32_t, int> counts_;
+  std::vector<std::unique_ptr<Client>> clients_;
+  Device sink_;
+  Device source_;
+  bool has_sink_ = true;
+  std::thread thread_;
+};
+
+}  // namespace test
+}  // namespace paknob
+
+#endif  // PAKNOB_TEST_FAKE_SERVER_H_
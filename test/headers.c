@@ -0,0 +1,12 @@
+// The installed headers, included together, must compile as strict C and,
+// through headers.cc, as C++.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "libpaknob.h"
+#include "state.h"
+
+enum paknob_target paknob_headers_target = PAKNOB_TARGET_SINK;
+struct paknob_device paknob_headers_device;
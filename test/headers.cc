@@ -0,0 +1 @@
+#include "headers.c"
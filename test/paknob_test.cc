@@ -0,0 +1,711 @@
+// Runs paknob and paknob-client against fake_server.h's server, each test in
+// a runtime directory and home of its own, and checks what they print, how
+// they exit, how long they take and what they leave the server's devices
+// at.
+//
+// Usage: paknob_test <paknob> <paknob-client> [<test>...]
+//
+// With test names, only those run. The evdev test needs /dev/uinput, and is
+// skipped without it.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <linux/uinput.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fake_server.h"
+#include "knob.h"
+#include "protocol.h"
+
+namespace paknob {
+namespace test {
+
+// For EXPECT_EQ, which finds them by argument-dependent lookup.
+std::ostream &operator<<(std::ostream &os, const Device &device) {
+  os << "{";
+  for (const uint32_t v : device.volume) os << v << " ";
+  return os << (device.mute ? "muted}" : "unmuted}");
+}
+bool operator==(const Device &a, const Device &b) {
+  return a.volume == b.volume && a.mute == b.mute;
+}
+
+}  // namespace test
+}  // namespace paknob
+
+namespace {
+
+using paknob::test::Device;
+using paknob::test::FakeServer;
+using paknob::test::Fault;
+using Clock = std::chrono::steady_clock;
+using std::chrono::milliseconds;
+
+enum class Outcome { kPass, kFail, kSkip };
+
+template <typename A, typename B>
+bool Check(const A &actual, const B &expected, const char *const expr,
+           const int line) {
+  if (actual == expected) return true;
+  std::ostringstream message;
+  message << __FILE__ << ":" << line << ": " << expr << " is " << actual
+          << ", expected " << expected << "\n";
+  fputs(message.str().c_str(), stderr);
+  return false;
+}
+
+#define EXPECT(cond)                                                \
+  do {                                                              \
+    if (!(cond)) {                                                  \
+      fprintf(stderr, "%s:%d: %s is false\n", __FILE__, __LINE__,   \
+              #cond);                                               \
+      return Outcome::kFail;                                        \
+    }                                                               \
+  } while (0)
+#define EXPECT_EQ(actual, expected)                      \
+  do {                                                   \
+    if (!Check((actual), (expected), #actual, __LINE__)) \
+      return Outcome::kFail;                             \
+  } while (0)
+
+std::string paknob_path;
+std::string client_path;
+
+Device Stereo(const uint32_t volume, const bool mute = false) {
+  return {{volume, volume}, mute};
+}
+
+// A runtime directory and home for one test, with a fake server in it, and
+// libpulse and paknob pointed at them.
+class Sandbox {
+ public:
+  static std::unique_ptr<Sandbox> Create() {
+    char dir[] = "/tmp/paknob_test.XXXXXX";
+    if (!mkdtemp(dir)) return {};
+    std::unique_ptr<Sandbox> sandbox(new Sandbox(dir));
+    const std::string home = sandbox->dir_ + "/home";
+    const std::string config = sandbox->dir_ + "/client.conf";
+    if (mkdir(home.c_str(), 0700) != 0) return {};
+    FILE *const f = fopen(config.c_str(), "w");
+    if (!f) return {};
+    fputs("autospawn = no\n", f);
+    fclose(f);
+    setenv("XDG_RUNTIME_DIR", sandbox->dir_.c_str(), 1);
+    setenv("HOME", home.c_str(), 1);
+    setenv("PULSE_CLIENTCONFIG", config.c_str(), 1);
+    for (const char *const var :
+         {"PULSE_SERVER", "PULSE_RUNTIME_PATH", "PULSE_COOKIE", "DISPLAY",
+          "XDG_CONFIG_HOME", "WAYLAND_DISPLAY"})
+      unsetenv(var);
+    sandbox->server_ = FakeServer::Start(sandbox->dir_);
+    if (!sandbox->server_) return {};
+    return sandbox;
+  }
+  ~Sandbox() {
+    server_.reset();
+    nftw(
+        dir_.c_str(),
+        [](const char *const path, const struct stat *, int, FTW *) {
+          return remove(path);
+        },
+        16, FTW_DEPTH | FTW_PHYS);
+  }
+
+  FakeServer &server() { return *server_; }
+  [[nodiscard]] std::string path(const std::string &name) const {
+    return dir_ + "/" + name;
+  }
+
+ private:
+  explicit Sandbox(std::string dir) : dir_{std::move(dir)} {}
+
+  const std::string dir_;
+  std::unique_ptr<FakeServer> server_;
+};
+
+struct Result {
+  // The exit status, or -1 if it had to be killed.
+  int status;
+  std::string out;
+  milliseconds elapsed;
+};
+
+// A child whose stdout, and optionally stdin, are pipes to us.
+class Process {
+ public:
+  static std::unique_ptr<Process> Spawn(const std::vector<std::string> &args,
+                                        const bool input = false) {
+    int out[2], in[2] = {-1, -1};
+    if (pipe2(out, O_CLOEXEC) != 0) return {};
+    if (input && pipe2(in, O_CLOEXEC) != 0) return {};
+    std::unique_ptr<Process> p(new Process);
+    p->start_ = Clock::now();
+    p->pid_ = fork();
+    if (p->pid_ < 0) return {};
+    if (p->pid_ == 0) {
+      dup2(out[1], STDOUT_FILENO);
+      if (input) dup2(in[0], STDIN_FILENO);
+      std::vector<char *> argv;
+      for (const auto &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+      argv.push_back(nullptr);
+      execv(argv[0], argv.data());
+      _exit(127);
+    }
+    close(out[1]);
+    p->out_ = out[0];
+    if (input) {
+      close(in[0]);
+      p->in_ = in[1];
+    }
+    return p;
+  }
+  ~Process() {
+    if (pid_ > 0) {
+      kill(pid_, SIGKILL);
+      waitpid(pid_, nullptr, 0);
+    }
+    if (out_ >= 0) close(out_);
+    CloseInput();
+  }
+
+  bool Write(const std::string &data) {
+    return write(in_, data.data(), data.size()) ==
+           static_cast<ssize_t>(data.size());
+  }
+  void CloseInput() {
+    if (in_ >= 0) close(in_);
+    in_ = -1;
+  }
+  void Signal(const int sig) { kill(pid_, sig); }
+  // Reads everything it prints until it exits, killing it after timeout.
+  Result Wait(const milliseconds timeout = milliseconds(5000)) {
+    const auto deadline = Clock::now() + timeout;
+    std::string out;
+    while (true) {
+      const auto left = std::chrono::duration_cast<milliseconds>(
+          deadline - Clock::now());
+      pollfd fd = {out_, POLLIN, 0};
+      if (left.count() <= 0 || poll(&fd, 1, left.count()) <= 0) break;
+      char buf[4096];
+      const ssize_t n = read(out_, buf, sizeof(buf));
+      if (n <= 0) break;
+      out.append(buf, n);
+    }
+    int status = -1;
+    if (Clock::now() >= deadline) kill(pid_, SIGKILL);
+    int wstatus;
+    waitpid(pid_, &wstatus, 0);
+    const auto elapsed =
+        std::chrono::duration_cast<milliseconds>(Clock::now() - start_);
+    if (WIFEXITED(wstatus) && Clock::now() < deadline)
+      status = WEXITSTATUS(wstatus);
+    pid_ = -1;
+    return {status, out, elapsed};
+  }
+  // What it has printed so far, waiting up to timeout for a whole line.
+  std::string ReadLine(const milliseconds timeout = milliseconds(2000)) {
+    const auto deadline = Clock::now() + timeout;
+    while (line_.find('\n') == line_.npos) {
+      const auto left = std::chrono::duration_cast<milliseconds>(
+          deadline - Clock::now());
+      pollfd fd = {out_, POLLIN, 0};
+      if (left.count() <= 0 || poll(&fd, 1, left.count()) <= 0) return {};
+      char buf[256];
+      const ssize_t n = read(out_, buf, sizeof(buf));
+      if (n <= 0) return {};
+      line_.append(buf, n);
+    }
+    const size_t end = line_.find('\n');
+    std::string line = line_.substr(0, end);
+    line_.erase(0, end + 1);
+    return line;
+  }
+
+ private:
+  Process() = default;
+
+  pid_t pid_ = -1;
+  int out_ = -1;
+  int in_ = -1;
+  Clock::time_point start_;
+  std::string line_;
+};
+
+Result Run(const std::vector<std::string> &args,
+           const milliseconds timeout = milliseconds(5000)) {
+  const auto p = Process::Spawn(args);
+  if (!p) return {-1, {}, {}};
+  return p->Wait(timeout);
+}
+
+// Polls until cond holds or timeout passes.
+bool Eventually(const std::function<bool()> &cond,
+                const milliseconds timeout = milliseconds(2000)) {
+  const auto deadline = Clock::now() + timeout;
+  while (!cond()) {
+    if (Clock::now() >= deadline) return false;
+    std::this_thread::sleep_for(milliseconds(5));
+  }
+  return true;
+}
+
+int Percentage(const Device &device) {
+  uint64_t sum = 0;
+  for (const uint32_t v : device.volume) sum += v;
+  return paknob::Percentage(sum / device.volume.size());
+}
+
+// Every reply is this late, so that each round trip shows in the time a
+// subcommand takes.
+constexpr milliseconds kLatency(40);
+// What a run may take beyond its round trips, however loaded the machine.
+constexpr milliseconds kSlack(1500);
+
+// The fake server starts with the sink at 50% and the source at 100%, both
+// unmuted. Connecting takes two round trips, for authentication and the
+// client name, and each subcommand one or two more.
+struct Case {
+  std::vector<std::string> args;
+  std::string out;
+  Device sink;
+  Device source;
+  int round_trips;
+};
+const Device kSink = Stereo(0x8000);
+const Device kSource = Stereo(0x10000);
+const std::vector<Case> &Cases() {
+  static const auto *const cases = new std::vector<Case>{
+      {{"get-sink-volume"}, "50\n", kSink, kSource, 3},
+      {{"set-sink-volume", "30"}, "30\n", Stereo(19660), kSource, 4},
+      {{"increment-sink-volume", "5"}, "55\n", Stereo(36044), kSource, 4},
+      {{"decrement-sink-volume", "5"}, "45\n", Stereo(29492), kSource, 4},
+      {{"get-source-volume"}, "100\n", kSink, kSource, 3},
+      {{"set-source-volume", "30"}, "30\n", kSink, Stereo(19660), 4},
+      {{"increment-source-volume", "5"}, "105\n", kSink, Stereo(68812), 4},
+      {{"decrement-source-volume", "5"}, "95\n", kSink, Stereo(62260), 4},
+      {{"get-sink-mute"}, "0\n", kSink, kSource, 3},
+      {{"set-sink-mute", "1"}, "0\n", Stereo(0x8000, true), kSource, 4},
+      {{"toggle-sink-mute"}, "0\n", Stereo(0x8000, true), kSource, 4},
+      {{"get-source-mute"}, "0\n", kSink, kSource, 3},
+      {{"set-source-mute", "0"}, "100\n", kSink, kSource, 4},
+      {{"toggle-source-mute"}, "0\n", kSink, Stereo(0x10000, true), 4},
+  };
+  return *cases;
+}
+
+Outcome RunCases(const std::string &binary, const bool fresh) {
+  for (const Case &c : Cases()) {
+    const auto sandbox = Sandbox::Create();
+    EXPECT(sandbox);
+    sandbox->server().set_latency(kLatency);
+    std::vector<std::string> args = {binary};
+    if (fresh) args.push_back("--fresh");
+    args.insert(args.end(), c.args.begin(), c.args.end());
+    const Result r = Run(args);
+    fprintf(stderr, "  %s: %lld ms\n", c.args.front().c_str(),
+            static_cast<long long>(r.elapsed.count()));
+    EXPECT_EQ(r.status, 0);
+    EXPECT_EQ(r.out, c.out);
+    EXPECT_EQ(sandbox->server().sink(), c.sink);
+    EXPECT_EQ(sandbox->server().source(), c.source);
+    EXPECT(r.elapsed >= c.round_trips * kLatency);
+    EXPECT(r.elapsed < c.round_trips * kLatency + kSlack);
+  }
+  return Outcome::kPass;
+}
+
+// All fourteen one-shot subcommands.
+Outcome OneShot() { return RunCases(paknob_path, /* fresh = */ true); }
+
+// The same through paknob-client, which without a daemon speaks the native
+// protocol itself if built to, and otherwise execs paknob.
+Outcome Client() { return RunCases(client_path, /* fresh = */ false); }
+
+Outcome Errors() {
+  {
+    const auto sandbox = Sandbox::Create();
+    EXPECT(sandbox);
+    sandbox->server().RemoveSink();
+    const Result r = Run({paknob_path, "get-sink-volume"});
+    EXPECT_EQ(r.status, 1);
+    EXPECT_EQ(r.out, "");
+  }
+  {
+    const auto sandbox = Sandbox::Create();
+    EXPECT(sandbox);
+    sandbox->server().Inject(paknob::test::kSetSinkVolume, Fault::kError);
+    const Result r = Run({paknob_path, "set-sink-volume", "10"});
+    EXPECT_EQ(r.status, 1);
+    EXPECT_EQ(r.out, "");
+  }
+  // Usage errors never reach the server.
+  {
+    const auto sandbox = Sandbox::Create();
+    EXPECT(sandbox);
+    EXPECT_EQ(Run({paknob_path, "set-sink-volume", "x"}).status, 1);
+    EXPECT_EQ(sandbox->server().count(paknob::test::kGetSinkInfo), 0);
+  }
+  return Outcome::kPass;
+}
+
+// A reply that never comes ends the run with the watchdog's status, in
+// about the time allowed.
+Outcome Timeout() {
+  const auto sandbox = Sandbox::Create();
+  EXPECT(sandbox);
+  sandbox->server().Inject(paknob::test::kGetSinkInfo, Fault::kDrop);
+  const Result r = Run({paknob_path, "--timeout=200", "get-sink-volume"});
+  EXPECT_EQ(r.status, 124);
+  EXPECT(r.elapsed >= milliseconds(200));
+  EXPECT(r.elapsed < milliseconds(200) + kSlack);
+  return Outcome::kPass;
+}
+
+// paknob-client gives up on a daemon that takes the request and never
+// answers, with the same status, rather than hanging its keybinding.
+Outcome ForwardTimeout() {
+  const auto sandbox = Sandbox::Create();
+  EXPECT(sandbox);
+  // Connections queue in the backlog, never accepted.
+  sockaddr_un addr;
+  EXPECT(paknob::DaemonAddress(&addr));
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  EXPECT(fd >= 0);
+  const bool listening =
+      bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == 0 &&
+      listen(fd, 1) == 0;
+  const Result r = Run({client_path, "get-sink-volume"});
+  close(fd);
+  EXPECT(listening);
+  EXPECT_EQ(r.status, 124);
+  EXPECT(r.elapsed >= milliseconds(2000));
+  EXPECT(r.elapsed < milliseconds(2000) + kSlack);
+  EXPECT_EQ(sandbox->server().count(paknob::test::kGetSinkInfo), 0);
+  return Outcome::kPass;
+}
+
+Outcome Disconnect() {
+  const auto sandbox = Sandbox::Create();
+  EXPECT(sandbox);
+  sandbox->server().Inject(paknob::test::kGetSinkInfo,
+                           Fault::kDisconnectBefore);
+  const Result r = Run({paknob_path, "get-sink-volume"});
+  EXPECT_EQ(r.status, 1);
+  EXPECT_EQ(r.out, "");
+  return Outcome::kPass;
+}
+
+// --retry runs again what was cut off before it changed anything, but not
+// an increment that may already have been applied.
+Outcome Retry() {
+  {
+    const auto sandbox = Sandbox::Create();
+    EXPECT(sandbox);
+    sandbox->server().Inject(paknob::test::kGetSinkInfo,
+                             Fault::kDisconnectBefore);
+    const Result r =
+        Run({paknob_path, "--retry=3000", "increment-sink-volume", "5"});
+    EXPECT_EQ(r.status, 0);
+    EXPECT_EQ(r.out, "55\n");
+    EXPECT_EQ(sandbox->server().sink(), Stereo(36044));
+  }
+  {
+    const auto sandbox = Sandbox::Create();
+    EXPECT(sandbox);
+    sandbox->server().Inject(paknob::test::kSetSinkVolume,
+                             Fault::kDisconnectAfter);
+    const Result r =
+        Run({paknob_path, "--retry=3000", "increment-sink-volume", "5"});
+    EXPECT_EQ(r.status, 1);
+    EXPECT_EQ(sandbox->server().sink(), Stereo(36044));
+    EXPECT_EQ(sandbox->server().count(paknob::test::kSetSinkVolume), 1);
+  }
+  {
+    const auto sandbox = Sandbox::Create();
+    EXPECT(sandbox);
+    sandbox->server().Inject(paknob::test::kSetSinkVolume,
+                             Fault::kDisconnectAfter);
+    const Result r =
+        Run({paknob_path, "--retry=3000", "set-sink-volume", "20"});
+    EXPECT_EQ(r.status, 0);
+    EXPECT_EQ(r.out, "20\n");
+    EXPECT_EQ(sandbox->server().count(paknob::test::kSetSinkVolume), 2);
+  }
+  return Outcome::kPass;
+}
+
+// A server that is down when paknob starts, and comes back within the
+// budget.
+Outcome Restart() {
+  const auto sandbox = Sandbox::Create();
+  EXPECT(sandbox);
+  sandbox->server().Stop();
+  const auto p =
+      Process::Spawn({paknob_path, "--retry=5000", "get-sink-volume"});
+  EXPECT(p);
+  std::this_thread::sleep_for(milliseconds(300));
+  EXPECT(sandbox->server().Restart());
+  const Result r = p->Wait();
+  EXPECT_EQ(r.status, 0);
+  EXPECT_EQ(r.out, "50\n");
+  return Outcome::kPass;
+}
+
+// Concurrent increments merge through the journal instead of losing each
+// other's read-modify-write cycles.
+Outcome DeltaJournal() {
+  const auto sandbox = Sandbox::Create();
+  EXPECT(sandbox);
+  sandbox->server().set_latency(milliseconds(30));
+  constexpr int kProcesses = 8;
+  std::vector<std::unique_ptr<Process>> processes;
+  for (int i = 0; i < kProcesses; i++) {
+    processes.push_back(
+        Process::Spawn({paknob_path, "--fresh", "increment-sink-volume",
+                        "1"}));
+    EXPECT(processes.back());
+  }
+  for (const auto &p : processes) {
+    const Result r = p->Wait();
+    EXPECT_EQ(r.status, 0);
+    int printed;
+    EXPECT(sscanf(r.out.c_str(), "%d", &printed) == 1);
+    EXPECT(printed > 50 && printed <= 50 + kProcesses);
+  }
+  EXPECT_EQ(sandbox->server().sink(),
+            Stereo(0x8000 + kProcesses * paknob::FromPercentage(1)));
+  // Merged increments share a write.
+  EXPECT(sandbox->server().count(paknob::test::kSetSinkVolume) <= kProcesses);
+  return Outcome::kPass;
+}
+
+// The daemon answers repeated queries, and writes that change nothing, from
+// its cache, and notices changes made by others.
+Outcome InfoCache() {
+  const auto sandbox = Sandbox::Create();
+  EXPECT(sandbox);
+  FakeServer &server = sandbox->server();
+  const auto daemon = Process::Spawn({paknob_path, "daemon"});
+  EXPECT(daemon);
+  EXPECT(server.WaitForCount(paknob::test::kGetSinkInfo, 1,
+                             milliseconds(2000)));
+  const std::string sock = sandbox->path("paknob.sock");
+  EXPECT(Eventually([&] { return access(sock.c_str(), F_OK) == 0; }));
+  // The first fetch may still be on its way.
+  std::this_thread::sleep_for(milliseconds(100));
+  const int gets = server.count(paknob::test::kGetSinkInfo);
+  for (int i = 0; i < 5; i++) {
+    const Result r = Run({client_path, "get-sink-volume"});
+    EXPECT_EQ(r.status, 0);
+    EXPECT_EQ(r.out, "50\n");
+  }
+  EXPECT_EQ(server.count(paknob::test::kGetSinkInfo), gets);
+  EXPECT_EQ(Run({client_path, "set-sink-volume", "50"}).status, 0);
+  EXPECT_EQ(server.count(paknob::test::kSetSinkVolume), 0);
+  server.SetSink(Stereo(paknob::FromPercentage(20)));
+  EXPECT(server.WaitForCount(paknob::test::kGetSinkInfo, gets + 1,
+                             milliseconds(2000)));
+  EXPECT(Eventually([&] {
+    return Run({client_path, "get-sink-volume"}).out == "20\n";
+  }));
+  daemon->Signal(SIGTERM);
+  EXPECT_EQ(daemon->Wait().status, 0);
+  return Outcome::kPass;
+}
+
+// knob-sink sums what arrives while a change is in flight, and applies all
+// of it before exiting at the end of its input.
+Outcome Knob() {
+  const auto sandbox = Sandbox::Create();
+  EXPECT(sandbox);
+  sandbox->server().set_latency(milliseconds(20));
+  const auto p = Process::Spawn({paknob_path, "knob-sink"}, /* input = */ true);
+  EXPECT(p);
+  EXPECT(p->Write("5\n-3\n"));
+  EXPECT(p->Write("10\n"));
+  p->CloseInput();
+  const Result r = p->Wait();
+  EXPECT_EQ(r.status, 0);
+  EXPECT(r.out.size() >= 3);
+  EXPECT_EQ(r.out.substr(r.out.size() - 3), "62\n");
+  EXPECT_EQ(Percentage(sandbox->server().sink()), 62);
+  return Outcome::kPass;
+}
+
+// A virtual knob made through uinput, with a dial and a mute key.
+class VirtualKnob {
+ public:
+  static std::unique_ptr<VirtualKnob> Create() {
+    const int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return {};
+    std::unique_ptr<VirtualKnob> knob(new VirtualKnob(fd));
+    uinput_setup setup = {};
+    setup.id.bustype = BUS_VIRTUAL;
+    snprintf(setup.name, sizeof(setup.name), "paknob test knob");
+    if (ioctl(fd, UI_SET_EVBIT, EV_REL) < 0 ||
+        ioctl(fd, UI_SET_RELBIT, REL_DIAL) < 0 ||
+        ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 ||
+        ioctl(fd, UI_SET_KEYBIT, KEY_MUTE) < 0 ||
+        ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0)
+      return {};
+    char sysname[64] = {};
+    if (ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) return {};
+    const std::string sys =
+        std::string("/sys/devices/virtual/input/") + sysname;
+    DIR *const dir = opendir(sys.c_str());
+    if (!dir) return {};
+    while (const dirent *const entry = readdir(dir)) {
+      if (strncmp(entry->d_name, "event", 5) == 0)
+        knob->path_ = std::string("/dev/input/") + entry->d_name;
+    }
+    closedir(dir);
+    const std::string &path = knob->path_;
+    if (path.empty() ||
+        !Eventually([&] { return access(path.c_str(), R_OK) == 0; }))
+      return {};
+    return knob;
+  }
+  ~VirtualKnob() { Unplug(); }
+
+  bool Turn(const int detents) { return Emit(EV_REL, REL_DIAL, detents); }
+  bool PressMute() {
+    return Emit(EV_KEY, KEY_MUTE, 1) && Emit(EV_KEY, KEY_MUTE, 0);
+  }
+  void Unplug() {
+    if (fd_ < 0) return;
+    ioctl(fd_, UI_DEV_DESTROY);
+    close(fd_);
+    fd_ = -1;
+  }
+  [[nodiscard]] const std::string &path() const { return path_; }
+
+ private:
+  explicit VirtualKnob(const int fd) : fd_{fd} {}
+  bool Emit(const uint16_t type, const uint16_t code, const int value) {
+    input_event events[2] = {};
+    events[0].type = type;
+    events[0].code = code;
+    events[0].value = value;
+    events[1].type = EV_SYN;
+    events[1].code = SYN_REPORT;
+    return write(fd_, events, sizeof(events)) == sizeof(events);
+  }
+
+  int fd_;
+  std::string path_;
+};
+
+// evdev-sink accelerates quick turns, clamps at silence and the maximum,
+// toggles the mute state, and exits when the device goes away.
+Outcome Evdev() {
+  const auto knob = VirtualKnob::Create();
+  if (!knob) return Outcome::kSkip;
+  const auto sandbox = Sandbox::Create();
+  EXPECT(sandbox);
+  FakeServer &server = sandbox->server();
+  const auto p = Process::Spawn({paknob_path, "evdev-sink", knob->path()});
+  EXPECT(p);
+  // The device is opened once the connection is ready.
+  EXPECT(server.WaitForCount(paknob::test::kSetClientName, 1,
+                             milliseconds(2000)));
+  std::this_thread::sleep_for(milliseconds(200));
+  // The second detent, 10 ms after the first, moves by the maximum
+  // acceleration of 5.
+  EXPECT(knob->Turn(1));
+  std::this_thread::sleep_for(milliseconds(10));
+  EXPECT(knob->Turn(1));
+  EXPECT(Eventually([&] { return Percentage(server.sink()) == 56; }));
+  // A slow one moves by 1.
+  std::this_thread::sleep_for(milliseconds(200));
+  EXPECT(knob->Turn(-1));
+  EXPECT(Eventually([&] { return Percentage(server.sink()) == 55; }));
+  std::this_thread::sleep_for(milliseconds(200));
+  EXPECT(knob->Turn(10000000));
+  EXPECT(Eventually(
+      [&] { return server.sink() == Stereo(paknob::kVolumeMax); }));
+  std::this_thread::sleep_for(milliseconds(200));
+  EXPECT(knob->Turn(-10000000));
+  EXPECT(Eventually([&] { return server.sink() == Stereo(0); }));
+  EXPECT(knob->PressMute());
+  EXPECT(Eventually([&] { return server.sink() == Stereo(0, true); }));
+  // Unplugging fails the read, which ends the subcommand.
+  knob->Unplug();
+  const Result r = p->Wait(milliseconds(2000));
+  EXPECT_EQ(r.status, 1);
+  EXPECT(r.out.size() >= 4);
+  EXPECT_EQ(r.out.substr(r.out.size() - 4), "0 1\n");
+  return Outcome::kPass;
+}
+
+struct Test {
+  const char *name;
+  Outcome (*run)();
+};
+constexpr Test kTests[] = {
+    {"OneShot", OneShot},               {"Client", Client},
+    {"Errors", Errors},                 {"Timeout", Timeout},
+    {"ForwardTimeout", ForwardTimeout}, {"Disconnect", Disconnect},
+    {"Retry", Retry},                   {"Restart", Restart},
+    {"DeltaJournal", DeltaJournal},     {"InfoCache", InfoCache},
+    {"Knob", Knob},                     {"Evdev", Evdev},
+};
+
+}  // namespace
+
+int main(const int argc, char **const argv) {
+  if (argc < 3) {
+    fprintf(stderr, "%s <paknob> <paknob-client> [<test>...]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  // Absolute, since paknob-client execs paknob from its PATH.
+  char *const paknob = realpath(argv[1], nullptr);
+  char *const client = realpath(argv[2], nullptr);
+  paknob_path = paknob ? paknob : argv[1];
+  client_path = client ? client : argv[2];
+  free(paknob);
+  free(client);
+  const std::string dir = paknob_path.substr(0, paknob_path.rfind('/'));
+  const char *const path = getenv("PATH");
+  setenv("PATH", (dir + ":" + (path ? path : "")).c_str(), 1);
+  signal(SIGPIPE, SIG_IGN);
+  int failed = 0;
+  for (const Test &test : kTests) {
+    bool wanted = argc == 3;
+    for (int i = 3; i < argc; i++) wanted |= strcmp(argv[i], test.name) == 0;
+    if (!wanted) continue;
+    fprintf(stderr, "%s\n", test.name);
+    switch (test.run()) {
+      case Outcome::kPass:
+        fprintf(stderr, "PASS %s\n", test.name);
+        break;
+      case Outcome::kFail:
+        fprintf(stderr, "FAIL %s\n", test.name);
+        failed++;
+        break;
+      case Outcome::kSkip:
+        fprintf(stderr, "SKIP %s\n", test.name);
+        break;
+    }
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}